@@ -0,0 +1,108 @@
+// adaptive_sampler.h
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#include "dispatcher.h"
+#include "logger.h"
+
+// ------------------------
+// Adaptive sampling
+// ------------------------
+// Decides when the next memory sample is due. Samples come at the fast rate
+// inside a window around the predicted next beat edge, where the phase
+// tracker gets its corrections, and just before the next choreography slot.
+// Between windows a sample is taken at the slow rate or at the start of the
+// next window, whichever comes first. When the beat counter hasn't moved for
+// a while (deck stopped) or nothing is playing, it stays at the slow rate.
+// Setting both rates equal gives the old fixed-rate poll.
+
+class AdaptiveSampler {
+public:
+    using Clock = timing::Clock;
+
+    /// What is coming up, as far as the caller knows
+    struct Outlook {
+        bool active = false;              // a choreography is playing
+        Clock::time_point lastBeatChange; // when the beat counter last moved
+        bool haveBeat = false;
+        Clock::time_point nextBeat;       // predicted next beat edge
+        bool haveEvent = false;
+        Clock::time_point nextEvent;      // next choreography slot
+    };
+
+    struct Stats {
+        uint64_t samples = 0;
+        uint64_t fast    = 0;   // taken inside a window
+        uint64_t idle    = 0;   // taken while stopped or inactive
+    };
+
+    /// Slowest and fastest sampling rate in Hz
+    void setRates(double minHz, double maxHz) {
+        slow_ = period(std::min(minHz, maxHz));
+        fast_ = period(std::max(minHz, maxHz));
+    }
+
+    /// How far around a beat edge (and ahead of a slot) to sample fast
+    void setWindow(Clock::duration window) { window_ = window; }
+
+    /// Beat counter unchanged for this long counts as stopped
+    void setIdleAfter(Clock::duration idle) { idleAfter_ = idle; }
+
+    /// Time of the sample after the one taken at `now`
+    Clock::time_point next(Clock::time_point now, const Outlook& o) {
+        if (!stats_.samples) {
+            start_ = now;
+            startCpu_ = timing::processCpuTime();
+        }
+        ++stats_.samples;
+
+        if (!o.active || now - o.lastBeatChange > idleAfter_) {
+            ++stats_.idle;
+            return now + slow_;
+        }
+
+        bool nearBeat  = o.haveBeat && now >= o.nextBeat - window_ && now <= o.nextBeat + window_;
+        bool nearEvent = o.haveEvent && now >= o.nextEvent - window_ && now <= o.nextEvent;
+        if (nearBeat || nearEvent) {
+            ++stats_.fast;
+            return now + fast_;
+        }
+
+        // sleep until the next window opens, but no longer than the slow period
+        auto next = now + slow_;
+        if (o.haveBeat && o.nextBeat - window_ > now) next = std::min(next, o.nextBeat - window_);
+        if (o.haveEvent && o.nextEvent - window_ > now) next = std::min(next, o.nextEvent - window_);
+        return next;
+    }
+
+    const Stats& stats() const { return stats_; }
+
+    void logStats() const {
+        if (!stats_.samples) return;
+        double seconds = std::chrono::duration<double>(Clock::now() - start_).count();
+        double cpu = timing::processCpuTime() - startCpu_;
+        LOG_INFO("Sampling: %llu samples in %.1f s, effective %.1f Hz (%llu fast, %llu idle; range %.0f-%.0f Hz), "
+                 "process CPU %.0f ms (%.2f%% of a core)",
+                 static_cast<unsigned long long>(stats_.samples), seconds,
+                 seconds > 0.0 ? stats_.samples / seconds : 0.0,
+                 static_cast<unsigned long long>(stats_.fast), static_cast<unsigned long long>(stats_.idle),
+                 hz(slow_), hz(fast_), cpu * 1000.0, seconds > 0.0 ? 100.0 * cpu / seconds : 0.0);
+    }
+
+private:
+    static Clock::duration period(double hz) {
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / std::max(hz, 0.1)));
+    }
+    static double hz(Clock::duration period) { return 1.0 / std::chrono::duration<double>(period).count(); }
+
+    Clock::duration slow_      = period(20.0);
+    Clock::duration fast_      = period(500.0);
+    Clock::duration window_    = std::chrono::milliseconds(10);
+    Clock::duration idleAfter_ = std::chrono::seconds(2);
+    Clock::time_point start_;
+    double startCpu_ = 0.0;
+    Stats stats_;
+};
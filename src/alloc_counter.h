@@ -0,0 +1,41 @@
+// alloc_counter.h
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// ------------------------
+// Heap allocation counter
+// ------------------------
+// Counts every global operator new, to check that steady-state paths don't
+// allocate. The replacement operators must be defined in exactly one
+// translation unit: expand RKBX_DEFINE_ALLOCATION_COUNTER there.
+
+namespace alloc_counter {
+
+inline std::atomic<uint64_t> allocations{ 0 };
+inline std::atomic<uint64_t> bytes{ 0 };
+// allocations made by the calling thread, for measuring one thread's hot
+// path while others (logger, watcher) allocate as they please
+inline thread_local uint64_t threadAllocations = 0;
+
+inline void* allocate(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    ++threadAllocations;
+    bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+} // namespace alloc_counter
+
+#define RKBX_DEFINE_ALLOCATION_COUNTER                                                          \
+    void* operator new(std::size_t size) { return alloc_counter::allocate(size); }             \
+    void* operator new[](std::size_t size) { return alloc_counter::allocate(size); }           \
+    void operator delete(void* p) noexcept { std::free(p); }                                   \
+    void operator delete[](void* p) noexcept { std::free(p); }                                 \
+    void operator delete(void* p, std::size_t) noexcept { std::free(p); }                      \
+    void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
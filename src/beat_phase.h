@@ -0,0 +1,154 @@
+// beat_phase.h
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+// ------------------------
+// Beat phase tracker
+// ------------------------
+// Rekordbox only exposes an integer beat counter, sampled once per poll. The
+// tracker keeps a continuous model of the deck's position in double
+// precision: position = anchorPos + ratio * nominal * (t - anchorTime), where
+// nominal is the reported tempo in beats per second and ratio a slowly
+// trimmed correction for what the rounded BPM doesn't capture.
+//
+// Each observed transition N-1 -> N is timestamped at the middle of the poll
+// interval it happened in, the best unbiased guess for the true edge. The
+// difference between N and the predicted position at that time is the phase
+// error; an alpha-beta loop moves the phase by alpha of it and the tempo ratio
+// by beta of it. A tempo change (pitch fader, nudge) re-anchors at the current
+// position and continues at the new rate, so nothing snaps. A jump by other
+// than one beat, or an error of more than half a beat, is a seek or a load
+// and re-anchors on the edge. Until the first +1 edge after a start or a
+// jump the phase is only known to the beat, so that edge anchors it as well.
+//
+// The reported position never runs past the next beat the counter hasn't
+// reached yet, so a stopped deck holds just before it.
+
+class BeatPhaseTracker {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /// Phase error at observed beat edges, in beats
+    struct Stats {
+        uint64_t edges       = 0;   // transitions that corrected the loop
+        uint64_t resyncs     = 0;   // seeks, loads and stalls that re-anchored it
+        double   sumAbsError = 0.0;
+        double   sumSqError  = 0.0;
+        double   maxAbsError = 0.0;
+
+        double meanAbsError() const { return edges ? sumAbsError / edges : 0.0; }
+        double rmsError() const { return edges ? std::sqrt(sumSqError / edges) : 0.0; }
+    };
+
+    /// Loop gains: share of each edge's phase error applied to the phase
+    /// (alpha) and to the tempo ratio (beta)
+    void setGains(double alpha, double beta) {
+        alpha_ = alpha;
+        beta_  = beta;
+    }
+
+    /// Feed one poll: the counter read `beat` at `now`, at a tempo of `bpm`
+    void observe(int32_t beat, Clock::time_point now, double bpm) { observe(beat, now, epoch_, bpm); }
+
+    /// Same, when polls may have happened that weren't fed in: `previous` is
+    /// the last time the counter was seen at its old value, which brackets
+    /// an edge more tightly than the previous call did (ignored if earlier)
+    void observe(int32_t beat, Clock::time_point now, Clock::time_point previous, double bpm) {
+        double t = seconds(now);
+        double nominal = bpm / 60.0;
+        if (!anchored_) {
+            epoch_ = now;
+            t = 0.0;
+            nominal_ = nominal;
+            anchor(beat, t);
+            counter_ = beat;
+            lastPoll_ = t;
+            anchored_ = true;
+            return;
+        }
+
+        if (beat != counter_) {
+            double edge = 0.5 * (std::clamp(seconds(previous), lastPoll_, t) + t);
+            double err = beat - rawPosition(edge);
+            if (!locked_) {
+                // first edge since the start: now the phase is known
+                anchor(beat, edge);
+                locked_ = beat == counter_ + 1;
+            } else if (beat == counter_ + 1 && std::abs(err) < kResyncBeats) {
+                anchorPos_  = rawPosition(edge) + alpha_ * err;
+                anchorTime_ = edge;
+                ratio_ = std::clamp(ratio_ + beta_ * err, 1.0 - kMaxTrim, 1.0 + kMaxTrim);
+                double a = std::abs(err);
+                ++stats_.edges;
+                stats_.sumAbsError += a;
+                stats_.sumSqError  += err * err;
+                stats_.maxAbsError  = std::max(stats_.maxAbsError, a);
+            } else {
+                ++stats_.resyncs;
+                anchor(beat, edge);
+                locked_ = beat == counter_ + 1;
+            }
+            counter_ = beat;
+        }
+
+        if (nominal != nominal_) {
+            // keep the phase, continue at the new rate
+            anchorPos_  = rawPosition(t);
+            anchorTime_ = t;
+            nominal_    = nominal;
+        }
+        lastPoll_ = t;
+    }
+
+    /// Estimated beat position at `t`
+    double position(Clock::time_point t) const {
+        if (!anchored_) return counter_;
+        return std::min(rawPosition(seconds(t)), counter_ + 1 - kHoldMargin);
+    }
+
+    /// Predicted time the deck reaches `beatPos`, assuming the tempo holds
+    Clock::time_point timeOf(double beatPos) const {
+        double rate = ratio_ * nominal_;
+        double t = anchorTime_ + (rate > 0.0 ? (beatPos - anchorPos_) / rate : 0.0);
+        return epoch_ + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(t));
+    }
+
+    /// Effective tempo in beats per minute
+    double bpm() const { return ratio_ * nominal_ * 60.0; }
+
+    /// Last integer beat the counter showed
+    int32_t counter() const { return counter_; }
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    static constexpr double kResyncBeats = 0.5;
+    static constexpr double kMaxTrim     = 0.02;  // ratio stays within ±2% of the reported tempo
+    static constexpr double kHoldMargin  = 1e-6;
+
+    double seconds(Clock::time_point t) const { return std::chrono::duration<double>(t - epoch_).count(); }
+
+    double rawPosition(double t) const { return anchorPos_ + ratio_ * nominal_ * (t - anchorTime_); }
+
+    void anchor(int32_t beat, double t) {
+        anchorPos_  = beat;
+        anchorTime_ = t;
+    }
+
+    Clock::time_point epoch_;
+    bool    anchored_   = false;
+    bool    locked_     = false;  // anchored on a +1 edge, not just a reading
+    int32_t counter_    = 0;
+    double  lastPoll_   = 0.0;  // seconds since epoch_
+    double  anchorPos_  = 0.0;  // beats
+    double  anchorTime_ = 0.0;  // seconds since epoch_
+    double  nominal_    = 2.0;  // reported tempo, beats per second
+    double  ratio_      = 1.0;
+    double  alpha_      = 0.25;
+    double  beta_       = 0.02;
+    Stats   stats_;
+};
@@ -1,47 +1,23 @@
 #pragma once
 
-#include <windows.h>
-#include <tlhelp32.h>
 #include <optional>
 #include <array>
 #include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <string>
 
 #include "offsets.h"
 #include "choreographer.h"
 #include "beat_utils.h"
-
-// ------------------------
-// Utilities to open process
-// ------------------------
-DWORD getProcessIdByName(const std::wstring& procName) {
-    PROCESSENTRY32W entry{ sizeof(entry) };
-    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
-    if (Process32FirstW(snapshot, &entry)) {
-        do {
-            if (procName == entry.szExeFile) {
-                CloseHandle(snapshot);
-                return entry.th32ProcessID;
-            }
-        } while (Process32NextW(snapshot, &entry));
-    }
-    CloseHandle(snapshot);
-    return 0;
-}
-
-SIZE_T getModuleBaseAddress(DWORD pid, const std::wstring& moduleName) {
-    MODULEENTRY32W me{ sizeof(me) };
-    HANDLE snap = CreateToolhelp32Snapshot(TH32CS_SNAPMODULE | TH32CS_SNAPMODULE32, pid);
-    if (Module32FirstW(snap, &me)) {
-        do {
-            if (moduleName == me.szModule) {
-                CloseHandle(snap);
-                return reinterpret_cast<SIZE_T>(me.modBaseAddr);
-            }
-        } while (Module32NextW(snap, &me));
-    }
-    CloseHandle(snap);
-    return 0;
-}
+#include "memory_source.h"
+#include "read_planner.h"
+#include "pointer_trie.h"
+#include "logger.h"
+#include "track_id.h"
+#include "beat_phase.h"
+#include "alloc_counter.h"
 
 // ------------------------
 // Generic memory‐reader
@@ -49,63 +25,120 @@ SIZE_T getModuleBaseAddress(DWORD pid, const std::wstring& moduleName) {
 template<typename T>
 class Value {
 public:
-    static Value<T> create(HANDLE hProc, SIZE_T base, const Pointer& p) {
-        SIZE_T addr = base;
+    static Value<T> create(MemorySource& mem, uintptr_t base, const Pointer& p) {
+        uintptr_t addr = base;
         // walk pointer chain
-        for (auto off : p.offsets) {
-            SIZE_T tmp;
-            ReadProcessMemory(hProc, (LPCVOID)(addr + off), &tmp, sizeof(tmp), nullptr);
+        for (auto off : p.hops()) {
+            uintptr_t tmp = 0;
+            mem.readValue(addr + off, tmp);
             addr = tmp;
         }
         addr += p.final_offset;
-        return Value(hProc, addr);
+        return Value(mem, addr);
     }
 
     T read() const {
-        T v;
-        ReadProcessMemory(hProc_, (LPCVOID)address_, &v, sizeof(v), nullptr);
+        T v{};
+        mem_->readValue(address_, v);
         return v;
     }
+
+    /// Value at an already resolved address
+    static Value<T> at(MemorySource& mem, uintptr_t address) { return Value(mem, address); }
+
+    /// Resolved address of the value, for batched reads
+    uintptr_t address() const { return address_; }
 private:
-    Value(HANDLE h, SIZE_T a) : hProc_(h), address_(a) {}
-    HANDLE hProc_;
-    SIZE_T address_;
+    Value(MemorySource& m, uintptr_t a) : mem_(&m), address_(a) {}
+    MemorySource* mem_;
+    uintptr_t address_;
+};
+
+/// Counters shared by the cached chain readers
+struct ChainCacheStats {
+    uint64_t validated = 0;   // reads served from the cached address
+    uint64_t rewalks = 0;     // re-resolutions of the chains (trie passes)
+    uint64_t readsSaved = 0;  // cross-process reads not made thanks to the cache
 };
 
-// Add this specialization after your generic Value<T>
+// Strings move when a track is loaded, so unlike the numeric fields this one
+// can't resolve its address once at startup. The resolution (made by a
+// PointerTrie pass) is cached together with the last hop, the pointer slot
+// that yields it; the batched track poll re-reads only that slot and has
+// the chains re-resolved when it changed, or every `revalidateEvery` in case
+// an earlier hop moved underneath it.
 template<>
 class Value<std::array<char, 100>> {
 public:
-    static Value<std::array<char, 100>> create(HANDLE hProc, SIZE_T base, const Pointer& p) {
-        return Value(hProc, base, p);
+    static Value<std::array<char, 100>> create(const Pointer& p, ChainCacheStats* stats = nullptr) {
+        return Value(p, stats);
     }
 
-    std::array<char, 100> read() const {
-        SIZE_T addr = base_;
-        // Walk pointer chain: at each step, read pointer at (addr + offset)
-        for (auto off : pointer_.offsets) {
-            SIZE_T tmp = 0;
-            if (!ReadProcessMemory(hProc_, (LPCVOID)(addr + off), &tmp, sizeof(tmp), nullptr))
-                return {};
-            addr = tmp;
-        }
-        addr += pointer_.final_offset;
-        std::array<char, 100> v{};
-        ReadProcessMemory(hProc_, (LPCVOID)addr, v.data(), v.size(), nullptr);
-        return v;
+    /// For batched reads: the slot to re-check, the value it must still hold,
+    /// and the string address it resolved to
+    bool      hasHop() const { return pointer_.depth != 0; }
+    uintptr_t lastHopSlot() const { return lastHopSlot_; }
+    uintptr_t lastHopValue() const { return lastHopValue_; }
+    uintptr_t resolved() const { return resolved_; }
+
+    /// True if the cached address must be re-resolved before use
+    bool due(std::chrono::steady_clock::time_point now) const {
+        return !cached_ || now - resolvedAt_ >= revalidateEvery_;
+    }
+
+    /// Count a read served from the cached address
+    void noteValidated() {
+        if (!stats_) return;
+        ++stats_->validated;
+        // a walk reads every hop; validation read just the last one
+        stats_->readsSaved += hasHop() ? pointer_.depth - 1u : 0;
     }
+
+    /// Take a resolution made elsewhere (a PointerTrie pass)
+    void assign(uintptr_t hopSlot, uintptr_t hopValue, uintptr_t address,
+                std::chrono::steady_clock::time_point now) {
+        lastHopSlot_ = hopSlot;
+        lastHopValue_ = hopValue;
+        resolved_ = address;
+        resolvedAt_ = now;
+        cached_ = true;
+    }
+
 private:
-    Value(HANDLE h, SIZE_T base, const Pointer& p)
-        : hProc_(h), base_(base), pointer_(p) {}
-    HANDLE hProc_;
-    SIZE_T base_;
+    Value(const Pointer& p, ChainCacheStats* stats) : pointer_(p), stats_(stats) {}
+
     Pointer pointer_;
+    ChainCacheStats* stats_;
+
+    // cached resolution
+    bool      cached_ = false;
+    uintptr_t resolved_ = 0;
+    uintptr_t lastHopSlot_ = 0;
+    uintptr_t lastHopValue_ = 0;
+    std::chrono::steady_clock::time_point resolvedAt_;
+    std::chrono::steady_clock::duration revalidateEvery_ = std::chrono::seconds(1);
 };
 
 // ------------------------
 // Rekordbox mirror
 // ------------------------
+
+/// Raw values of one tick, filled in by batched reads: the beat fields
+/// every tick, the track strings only every track poll
+struct RekordboxSnapshot {
+    float    master_bpm;
+    int32_t  bar1, beat1, bar2, beat2;
+    uint8_t  masterdeck_index;
+    // last hop of each string chain (artist1, title1, artist2, title2),
+    // re-read every track poll to validate the cached string addresses
+    uintptr_t string_hops[4];
+    std::array<char, 100> strings[4];
+};
+
 struct Rekordbox {
+    // where the values are read from; outlives every Value<T> below
+    std::unique_ptr<MemorySource> mem_;
+
     // hold in optionals so we can delay construction until we have hProc & base
     std::optional<Value<float>>    master_bpm_val;
     std::optional<Value<int32_t>>  bar1_val, beat1_val, bar2_val, beat2_val;
@@ -121,139 +154,359 @@ struct Rekordbox {
     float   master_bpm{ 120.0f };
     uint8_t masterdeck_index{ 0 };
 
-    // New: Actual string fields
-    std::string deck1_artist, deck1_title, deck2_artist, deck2_title;
-
-    Rekordbox(const RekordboxOffsets& off) {
-        // 1) find & open process
-        DWORD pid = getProcessIdByName(L"rekordbox.exe");
-        if (!pid) throw std::runtime_error("Rekordbox not running");
-        HANDLE h = OpenProcess(PROCESS_VM_READ | PROCESS_QUERY_INFORMATION,
-            FALSE, pid);
-        if (!h)  throw std::runtime_error("Failed to OpenProcess");
-
-        // 2) find module base
-        SIZE_T base = getModuleBaseAddress(pid, L"rekordbox.exe");
-        if (!base) throw std::runtime_error("Module base not found");
-
-        // 3) now construct each Value<T> in place
-        master_bpm_val = Value<float>::create(h, base, off.master_bpm);
-        bar1_val = Value<int32_t>::create(h, base, off.deck1bar);
-        beat1_val = Value<int32_t>::create(h, base, off.deck1beat);
-        bar2_val = Value<int32_t>::create(h, base, off.deck2bar);
-        beat2_val = Value<int32_t>::create(h, base, off.deck2beat);
-        masterdeck_index_val = Value<uint8_t>::create(h, base, off.masterdeck_index);
+    // track loaded on each deck, as of the last track poll
+    TrackId deck1_track, deck2_track;
+
+    RekordboxSnapshot snapshot{};
+    ChainCacheStats chain_stats;
+    uint64_t refreshes{ 0 };
+    uint64_t track_polls{ 0 };
+
+    Rekordbox(const RekordboxOffsets& off)
+        : Rekordbox(off, MemorySource::open("rekordbox.exe")) {}
+
+    Rekordbox(const RekordboxOffsets& off, std::unique_ptr<MemorySource> mem)
+        : mem_(std::move(mem))
+    {
+        MemorySource& m = *mem_;
+        uintptr_t base = m.moduleBase();
+
+        // resolve every chain in one pass over the shared-prefix trie
+        using F = RekordboxOffsets;
+        trie_ = PointerTrie::compile(off);
+        trie_.resolve(m, base, resolved_);
+
+        // construct each Value<T> in place
+        master_bpm_val = Value<float>::at(m, resolved_[F::MasterBpm].address);
+        bar1_val = Value<int32_t>::at(m, resolved_[F::Deck1Bar].address);
+        beat1_val = Value<int32_t>::at(m, resolved_[F::Deck1Beat].address);
+        bar2_val = Value<int32_t>::at(m, resolved_[F::Deck2Bar].address);
+        beat2_val = Value<int32_t>::at(m, resolved_[F::Deck2Beat].address);
+        masterdeck_index_val = Value<uint8_t>::at(m, resolved_[F::MasterdeckIndex].address);
 
         // New: construct Value for artist/track strings
-        deck1_artist_val = Value<std::array<char, 100>>::create(h, base, off.deck1artist);
-        deck1_title_val  = Value<std::array<char, 100>>::create(h, base, off.deck1title);
-        deck2_artist_val = Value<std::array<char, 100>>::create(h, base, off.deck2artist);
-        deck2_title_val  = Value<std::array<char, 100>>::create(h, base, off.deck2title);
+        deck1_artist_val = Value<std::array<char, 100>>::create(off.deck1artist, &chain_stats);
+        deck1_title_val  = Value<std::array<char, 100>>::create(off.deck1title,  &chain_stats);
+        deck2_artist_val = Value<std::array<char, 100>>::create(off.deck2artist, &chain_stats);
+        deck2_title_val  = Value<std::array<char, 100>>::create(off.deck2title,  &chain_stats);
+        assignStrings(std::chrono::steady_clock::now());
+        buildBeatPlan();
     }
 
+    /// How often the track strings are read; the beat fields are read every refresh
+    void setTrackPollInterval(std::chrono::steady_clock::duration d) { trackPollEvery_ = d; }
+
     void refresh() {
-        master_bpm = (*master_bpm_val).read();
+        ++refreshes;
+        auto now = std::chrono::steady_clock::now();
+
+        // beat fields in one scatter-gather read
+        beat_plan_.execute(*mem_, &snapshot);
+
+        master_bpm = snapshot.master_bpm;
         
         // Use the static conversion methods
-        int bar1 = (*bar1_val).read();
-        int beat1 = (*beat1_val).read();
-        int bar2 = (*bar2_val).read();
-        int beat2 = (*beat2_val).read();
-        
-        beats1 = barBeatToBeatNumber(bar1, beat1);
-        beats2 = barBeatToBeatNumber(bar2, beat2);
+        beats1 = barBeatToBeatNumber(snapshot.bar1, snapshot.beat1);
+        beats2 = barBeatToBeatNumber(snapshot.bar2, snapshot.beat2);
         
-        masterdeck_index = (*masterdeck_index_val).read();
+        masterdeck_index = snapshot.masterdeck_index;
         master_beats = (masterdeck_index == 0 ? beats1 : beats2);
 
-        // Use strnlen to ensure null-termination
-        auto arr_to_str = [](const std::array<char, 100>& arr) {
-            return std::string(arr.data(), strnlen(arr.data(), arr.size()));
-        };
-        deck1_artist = arr_to_str((*deck1_artist_val).read());
-        deck1_title  = arr_to_str((*deck1_title_val).read());
-        deck2_artist = arr_to_str((*deck2_artist_val).read());
-        deck2_title  = arr_to_str((*deck2_title_val).read());
-        //std::cout << "Rekordbox state: "
-        //          << ", Deck 1: " << deck1_artist << " - " << deck1_title
-        //         << ", Deck 2: " << deck2_artist << " - " << deck2_title
-        //          << std::endl;
+        if (now >= nextTrackPoll_) {
+            pollTracks(now);
+            nextTrackPoll_ = now + trackPollEvery_;
+        }
+    }
+
+    /// Track on the master deck
+    const TrackId& masterTrack() const { return masterdeck_index == 0 ? deck1_track : deck2_track; }
+
+    /// Track and beat number on deck `deck` (0 or 1)
+    const TrackId& deckTrack(int deck) const { return deck == 0 ? deck1_track : deck2_track; }
+    int32_t deckBeats(int deck) const { return deck == 0 ? beats1 : beats2; }
+
+    void logStats() const {
+        if (!refreshes) return;
+        LOG_INFO("Memory read syscalls: %.2f per tick over %llu ticks (%zu beat fields in %zu ranges, "
+                 "%llu track polls of %zu fields in %zu ranges); string chains saved %.1f reads per "
+                 "poll (%llu cached reads, %llu trie passes over %zu nodes)",
+                 double(mem_->readCalls()) / refreshes, static_cast<unsigned long long>(refreshes),
+                 beat_plan_.fieldCount(), beat_plan_.rangeCount(),
+                 static_cast<unsigned long long>(track_polls),
+                 track_plan_.fieldCount(), track_plan_.rangeCount(),
+                 track_polls ? double(chain_stats.readsSaved) / track_polls : 0.0,
+                 static_cast<unsigned long long>(chain_stats.validated),
+                 static_cast<unsigned long long>(chain_stats.rewalks), trie_.nodeCount());
+    }
+
+private:
+    /// Read the artist/title strings of both decks
+    void pollTracks(std::chrono::steady_clock::time_point now) {
+        ++track_polls;
+        Value<std::array<char, 100>>* strs[4] = {
+            &*deck1_artist_val, &*deck1_title_val, &*deck2_artist_val, &*deck2_title_val };
+
+        // string chains due for their slow revalidation are re-resolved up front
+        bool stale = false;
+        for (auto* v : strs) stale = stale || v->due(now);
+        if (stale) resolveStrings(now);
+        if (track_plan_dirty_) buildTrackPlan();
+
+        track_plan_.execute(*mem_, &snapshot);
+
+        // a string moved: re-resolve and read again
+        bool moved = false;
+        for (int i = 0; i < 4; ++i) {
+            if (strs[i]->hasHop() && snapshot.string_hops[i] != strs[i]->lastHopValue())
+                moved = true;
+        }
+        if (moved) {
+            resolveStrings(now);
+            buildTrackPlan();
+            track_plan_.execute(*mem_, &snapshot);
+        } else {
+            for (auto* v : strs) v->noteValidated();
+        }
+
+        deck1_track.assign(snapshot.strings[0], snapshot.strings[1]);
+        deck2_track.assign(snapshot.strings[2], snapshot.strings[3]);
+    }
+
+    /// Re-run the trie over every chain and point the string readers at the result
+    void resolveStrings(std::chrono::steady_clock::time_point now) {
+        ++chain_stats.rewalks;
+        trie_.resolve(*mem_, mem_->moduleBase(), resolved_);
+        assignStrings(now);
+        track_plan_dirty_ = true;
+    }
+
+    void assignStrings(std::chrono::steady_clock::time_point now) {
+        using F = RekordboxOffsets;
+        std::pair<Value<std::array<char, 100>>*, F::Field> strs[4] = {
+            { &*deck1_artist_val, F::Deck1Artist }, { &*deck1_title_val, F::Deck1Title },
+            { &*deck2_artist_val, F::Deck2Artist }, { &*deck2_title_val, F::Deck2Title } };
+        for (auto& [v, f] : strs)
+            v->assign(resolved_[f].hopSlot, resolved_[f].hopValue, resolved_[f].address, now);
+    }
+
+    size_t snapshotOffset(const void* field) const {
+        return static_cast<size_t>(static_cast<const char*>(field) - reinterpret_cast<const char*>(&snapshot));
+    }
+
+    /// Lay out the per-tick fields for one batched read
+    void buildBeatPlan() {
+        const RekordboxSnapshot& s = snapshot;
+        beat_plan_.clear();
+        beat_plan_.add(master_bpm_val->address(), sizeof(s.master_bpm), snapshotOffset(&s.master_bpm));
+        beat_plan_.add(bar1_val->address(),  sizeof(s.bar1),  snapshotOffset(&s.bar1));
+        beat_plan_.add(beat1_val->address(), sizeof(s.beat1), snapshotOffset(&s.beat1));
+        beat_plan_.add(bar2_val->address(),  sizeof(s.bar2),  snapshotOffset(&s.bar2));
+        beat_plan_.add(beat2_val->address(), sizeof(s.beat2), snapshotOffset(&s.beat2));
+        beat_plan_.add(masterdeck_index_val->address(), sizeof(s.masterdeck_index),
+                       snapshotOffset(&s.masterdeck_index));
+        beat_plan_.build();
     }
+
+    /// Lay out the string hops and strings for one batched read
+    void buildTrackPlan() {
+        const RekordboxSnapshot& s = snapshot;
+        const Value<std::array<char, 100>>* strs[4] = {
+            &*deck1_artist_val, &*deck1_title_val, &*deck2_artist_val, &*deck2_title_val };
+        track_plan_.clear();
+        for (int i = 0; i < 4; ++i) {
+            if (strs[i]->hasHop())
+                track_plan_.add(strs[i]->lastHopSlot(), sizeof(uintptr_t), snapshotOffset(&s.string_hops[i]));
+            track_plan_.add(strs[i]->resolved(), sizeof(s.strings[i]), snapshotOffset(&s.strings[i]));
+        }
+        track_plan_.build();
+        track_plan_dirty_ = false;
+    }
+
+    PointerTrie trie_;
+    std::array<PointerTrie::Resolved, PointerTrie::kFields> resolved_{};
+    ReadPlan beat_plan_;
+    ReadPlan track_plan_;
+    bool track_plan_dirty_ = true;
+    std::chrono::steady_clock::duration trackPollEvery_ = std::chrono::milliseconds(250);
+    std::chrono::steady_clock::time_point nextTrackPoll_{};
 };
 
 // ------------------------
 // Beat‐tracking logic
 // ------------------------
 
+/// Everything one sample of Rekordbox yields: what the sampler thread
+/// hands to the dispatcher thread
+struct RekordboxSample {
+    std::chrono::steady_clock::time_point sampled;
+    // per deck: the last sample that still showed the previous beat counter
+    std::array<std::chrono::steady_clock::time_point, 2> before_edge;
+    float    master_bpm = 0.0f;
+    int32_t  beats[2] = { 0, 0 };
+    uint8_t  masterdeck_index = 0;
+    TrackId  tracks[2];
+    uint64_t allocations = 0;  // heap allocations taking this sample made
+};
+
 class BeatKeeper {
 public:
     BeatKeeper(const RekordboxOffsets& off, Choreographer* choreo)
-        : rb_(off)
+        : rb_(std::in_place, off)
         , choreo_(choreo)
         , last_beat_(0)
-        , beat_fraction_(1.0f)
         , last_masterdeck_index_(0)
         , offset_micros_(0.0f)
         , last_bpm_(0.0f)
         , new_beat_(false)
-        , last_master_artist_()
-        , last_master_title_()
-        , last_update_time_(std::chrono::high_resolution_clock::now())
+        , last_update_time_(std::chrono::steady_clock::now())
     {
     }
 
-    void update(std::chrono::microseconds delta) {
-        rb_.refresh();
-        
-        auto current_time = std::chrono::high_resolution_clock::now();
-        auto actual_delta = std::chrono::duration_cast<std::chrono::microseconds>(
-            current_time - last_update_time_);
-        last_update_time_ = current_time;
+    /// Without a Rekordbox reader: samples come from elsewhere (a trace
+    /// replay) and only apply() is used
+    explicit BeatKeeper(Choreographer* choreo)
+        : choreo_(choreo)
+        , last_beat_(0)
+        , last_masterdeck_index_(0)
+        , offset_micros_(0.0f)
+        , last_bpm_(0.0f)
+        , new_beat_(false)
+        , last_update_time_(std::chrono::steady_clock::now())
+    {
+    }
+
+    /// Sampler side: read Rekordbox once into `s`. Only touches the reader
+    /// state, so it can run on another thread than apply().
+    void sample(RekordboxSample& s) {
+        uint64_t allocs_before = alloc_counter::threadAllocations;
+        Rekordbox& rb = *rb_;
+        rb.refresh();
+        auto now = std::chrono::steady_clock::now();
+
+        s.sampled = now;
+        s.master_bpm = rb.master_bpm;
+        s.masterdeck_index = rb.masterdeck_index;
+        for (int deck = 0; deck < kDecks; ++deck) {
+            int32_t beats = rb.deckBeats(deck);
+            if (beats != s.beats[deck]) s.before_edge[deck] = last_sample_time_;
+            s.beats[deck] = beats;
+            s.tracks[deck] = rb.deckTrack(deck);
+        }
+        if (rb.master_beats != last_counter_) {
+            last_counter_ = rb.master_beats;
+            last_counter_change_ = now;
+        }
+        last_sample_time_ = now;
+        s.allocations = alloc_counter::threadAllocations - allocs_before;
+    }
+
+    /// Dispatcher side: follow the beat of both decks and drive the
+    /// choreographer from sample `s`. Applying the same sample again just
+    /// advances the beat positions to the current time.
+    void apply(const RekordboxSample& s) { apply(s, std::chrono::steady_clock::now()); }
+
+    /// apply() as of `now`, which a replay in virtual time supplies itself
+    void apply(const RekordboxSample& s, std::chrono::steady_clock::time_point now) {
+        uint64_t allocs_before = alloc_counter::threadAllocations;
+        bool steady = true;
+
+        auto actual_delta = std::chrono::duration_cast<std::chrono::microseconds>(now - last_update_time_);
+        last_update_time_ = now;
 
         // --- BPM change ---
-        if (rb_.master_bpm != last_bpm_) {
-            last_bpm_ = rb_.master_bpm;
-            if (choreo_) choreo_->onBpmChanged(rb_.master_bpm);
+        if (s.master_bpm != last_bpm_) {
+            last_bpm_ = s.master_bpm;
+            steady = false;
+            if (choreo_) choreo_->onBpmChanged(s.master_bpm);
         }
 
-        // --- Deck switch or track change on master deck ---
-        std::string current_master_artist = (rb_.masterdeck_index == 0) ? rb_.deck1_artist : rb_.deck2_artist;
-        std::string current_master_title = (rb_.masterdeck_index == 0) ? rb_.deck1_title : rb_.deck2_title;
-        
-        if (rb_.masterdeck_index != last_masterdeck_index_ || 
-            current_master_artist != last_master_artist_ || 
-            current_master_title != last_master_title_) {
-            
-            last_masterdeck_index_ = rb_.masterdeck_index;
-            last_master_artist_ = current_master_artist;
-            last_master_title_ = current_master_title;
-            last_beat_ = rb_.master_beats;
-            
+        // --- Track changes: the choreographies of both decks stay loaded ---
+        // compared by hash/memcmp; strings are only built when one changed
+        for (int deck = 0; deck < kDecks; ++deck) {
+            const TrackId& current = s.tracks[deck];
+            if (current == last_tracks_[deck]) continue;
+            last_tracks_[deck] = current;
+            steady = false;
+            if (choreo_) choreo_->onDeckTrackChanged(deck, current.artistString(), current.titleString());
+        }
+
+        // --- Beat phase, per deck; both run at the master tempo ---
+        auto offset = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double, std::micro>(offset_micros_));
+        for (int deck = 0; deck < kDecks; ++deck) {
+            phase_[deck].observe(s.beats[deck], s.sampled, s.before_edge[deck], s.master_bpm);
+            positions_[deck] = phase_[deck].position(now + offset);
+        }
+
+        // --- Deck switch ---
+        master_ = s.masterdeck_index;
+        int32_t master_beat = static_cast<int32_t>(std::floor(positions_[master_]));
+        if (s.masterdeck_index != last_masterdeck_index_) {
+            last_masterdeck_index_ = s.masterdeck_index;
+            last_beat_ = master_beat;
+            steady = false;
             if (choreo_) {
-                choreo_->onMasterTrackChanged(current_master_artist, current_master_title);
-                choreo_->onNewBeat(rb_.master_beats);
+                choreo_->onMasterDeckChanged(master_);
+                choreo_->onNewBeat(master_beat);
             }
         }
 
         // --- Beat tracking ---
-        if (std::abs(rb_.master_beats - last_beat_) > 0) {
-            last_beat_ = rb_.master_beats;
-            beat_fraction_ = 0.0f;
+        if (master_beat != last_beat_) {
+            last_beat_ = master_beat;
             new_beat_ = true;
-            
-            if (choreo_) choreo_->onNewBeat(rb_.master_beats);
-        } else {
-            float beats_per_micro = rb_.master_bpm / 60.0f / 1'000'000.0f;
-            beat_fraction_ = std::fmod(beat_fraction_ + actual_delta.count() * beats_per_micro, 1.0f);
+            if (choreo_) choreo_->onNewBeat(master_beat);
         }
-        
-        // Always send beat fraction update with delta time
-        if (choreo_) choreo_->onBeatFraction(getBeatFraction(), actual_delta);
+
+        if (choreo_) {
+            for (int deck = 0; deck < kDecks; ++deck) {
+                double beat = std::floor(positions_[deck]);
+                choreo_->onDeckPosition(deck, static_cast<int>(beat), positions_[deck] - beat);
+            }
+            // Always send beat fraction update with delta time
+            choreo_->onBeatFraction(getBeatFraction(), actual_delta, now);
+        }
+
+        if (steady) {
+            ++steady_ticks_;
+            steady_allocs_ += alloc_counter::threadAllocations - allocs_before;
+            // count each sample's own allocations once
+            if (s.sampled != last_applied_) steady_allocs_ += s.allocations;
+        }
+        last_applied_ = s.sampled;
     }
 
-    float getBeatFraction() const {
-        float beats_per_micro = rb_.master_bpm / 60.0f / 1'000'000.0f;
-        return std::fmod(beat_fraction_ + offset_micros_ * beats_per_micro + 1.0f, 1.0f);
+    void setTrackPollInterval(std::chrono::milliseconds interval) {
+        if (rb_) rb_->setTrackPollInterval(interval);
+    }
+
+    void logStats() const {
+        if (rb_) rb_->logStats();
+        for (int deck = 0; deck < kDecks; ++deck) {
+            const auto& st = phase_[deck].stats();
+            if (!st.edges && !st.resyncs) continue;
+            LOG_INFO("Deck %d beat phase: %llu edges, error mean %.2f ms, rms %.2f ms, max %.2f ms, "
+                     "%llu resyncs, tracked tempo %.3f BPM",
+                     deck + 1, static_cast<unsigned long long>(st.edges),
+                     beatsToMs(st.meanAbsError()), beatsToMs(st.rmsError()), beatsToMs(st.maxAbsError),
+                     static_cast<unsigned long long>(st.resyncs), phase_[deck].bpm());
+        }
+        LOG_INFO("Steady-state ticks: %llu, heap allocations during them: %llu",
+                 static_cast<unsigned long long>(steady_ticks_),
+                 static_cast<unsigned long long>(steady_allocs_));
+    }
+
+    double getBeatFraction() const { return getBeatFraction(master_); }
+
+    double getBeatFraction(int deck) const { return positions_[deck] - std::floor(positions_[deck]); }
+
+    /// When the master deck's beat counter last moved (sampler side)
+    std::chrono::steady_clock::time_point lastBeatChangeTime() const { return last_counter_change_; }
+
+    /// Predicted time of the master deck's next beat (dispatcher side)
+    std::chrono::steady_clock::time_point nextBeatTime() const {
+        const auto& phase = phase_[master_];
+        return phase.timeOf(phase.counter() + 1);
     }
 
     void changeOffsetMs(float ms) {
@@ -261,15 +514,30 @@ public:
     }
 
 private:
-    Rekordbox rb_;
+    static constexpr int kDecks = 2;
+
+    // sampler side
+    std::optional<Rekordbox> rb_;  // empty when replaying a trace
+    int32_t   last_counter_ = 0;  // raw master beat counter
+    std::chrono::steady_clock::time_point last_counter_change_;
+    std::chrono::steady_clock::time_point last_sample_time_;
+
+    // dispatcher side
     Choreographer* choreo_;
     int32_t   last_beat_;
-    float     beat_fraction_;
     uint8_t   last_masterdeck_index_;
+    int       master_ = 0;
     float     offset_micros_;
     float     last_bpm_;
     bool      new_beat_;
-    std::string last_master_artist_;
-    std::string last_master_title_;
-    std::chrono::high_resolution_clock::time_point last_update_time_;
+    std::array<TrackId, kDecks> last_tracks_{};
+    std::array<BeatPhaseTracker, kDecks> phase_;
+    std::array<double, kDecks> positions_{};  // this tick, with the offset applied
+    std::chrono::steady_clock::time_point last_applied_;
+    std::chrono::steady_clock::time_point last_update_time_;
+    double beatsToMs(double beats) const { return last_bpm_ > 0.0f ? beats * 60'000.0 / last_bpm_ : 0.0; }
+
+    // ticks without a BPM or track change, and what they allocated
+    uint64_t  steady_ticks_ = 0;
+    uint64_t  steady_allocs_ = 0;
 };
\ No newline at end of file
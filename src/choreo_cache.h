@@ -0,0 +1,179 @@
+// choreo_cache.h
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "choreoparser.h"
+#include "choreo_compiled.h"
+#include "logger.h"
+
+namespace choreo {
+
+// ------------------------
+// Parsed choreography cache
+// ------------------------
+// Bodies are parsed the first time their file is needed and kept in an LRU
+// bounded by an approximate byte budget. Entries are shared_ptrs, so
+// evicting the choreography that is currently playing only drops the
+// cache's reference; it is freed once playback moves on.
+//
+// With a compiled directory set, a miss first tries to map the compiled
+// form of the file and only parses the TSV (then compiles it) when that is
+// missing or stale.
+//
+// The loader thread gets entries while the dispatcher puts reloads, so every
+// call takes a lock; a miss loads the file outside of it.
+
+class ChoreoCache {
+public:
+    struct Stats {
+        uint64_t hits      = 0;
+        uint64_t misses    = 0;
+        uint64_t evictions = 0;
+        uint64_t mapped    = 0;    // misses served from a compiled file
+        uint64_t compiled  = 0;    // compiled files (re)written
+        double   parseMs   = 0.0;  // total time spent loading on misses
+    };
+
+    static constexpr size_t kDefaultBudget = 64u << 20;
+
+    explicit ChoreoCache(size_t budgetBytes = kDefaultBudget) : budget_(budgetBytes) {}
+
+    /// Where compiled choreographies are kept; empty disables them
+    void setCompiledDir(std::filesystem::path dir) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        compiledDir_ = std::move(dir);
+    }
+
+    void setBudget(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        budget_ = bytes;
+        evict();
+    }
+
+    /// Parsed choreography of `path`, parsing it on a miss.
+    /// Throws whatever the parser throws; nothing is cached then.
+    std::shared_ptr<ChoreoParser> get(const std::string& path) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto it = entries_.find(path);
+        if (it != entries_.end()) {
+            ++stats_.hits;
+            lru_.splice(lru_.begin(), lru_, it->second.pos);
+            return it->second.parser;
+        }
+        ++stats_.misses;
+        std::filesystem::path compiledDir = compiledDir_;
+        lock.unlock();
+
+        auto start = std::chrono::steady_clock::now();
+        std::shared_ptr<ChoreoParser> parser;
+        std::filesystem::path compiled;
+        if (!compiledDir.empty()) {
+            compiled = ChoreoCompiled::pathFor(compiledDir, path);
+            parser = ChoreoCompiled::load(compiled, path);
+        }
+        const bool mapped = parser != nullptr;
+        bool written = false;
+        if (!mapped) {
+            parser = std::make_shared<ChoreoParser>(path);
+            written = !compiled.empty() && ChoreoCompiled::write(compiled, path, *parser);
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        lock.lock();
+        stats_.mapped   += mapped;
+        stats_.compiled += written;
+        stats_.parseMs  += ms;
+        // a reload put while this one was loading is the newer version
+        it = entries_.find(path);
+        if (it != entries_.end()) return it->second.parser;
+        size_t bytes = parser->memoryBytes();
+        lru_.push_front(path);
+        entries_[path] = Entry{ parser, bytes, lru_.begin() };
+        bytes_ += bytes;
+        LOG_INFO("%s choreography %s in %.2f ms (%zu KiB)", mapped ? "Mapped" : "Parsed",
+                 path.c_str(), ms, bytes >> 10);
+        evict();
+        return parser;
+    }
+
+    /// Install an already parsed version of `path` (e.g. a hot reload),
+    /// replacing any cached one
+    void put(const std::string& path, std::shared_ptr<ChoreoParser> parser) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        drop(path);
+        size_t bytes = parser->memoryBytes();
+        lru_.push_front(path);
+        entries_[path] = Entry{ std::move(parser), bytes, lru_.begin() };
+        bytes_ += bytes;
+        evict();
+    }
+
+    /// Drop `path` so the next get() re-parses it
+    void invalidate(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        drop(path);
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return entries_.size();
+    }
+    size_t bytes() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return bytes_;
+    }
+    size_t budget() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return budget_;
+    }
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<ChoreoParser> parser;
+        size_t bytes;
+        std::list<std::string>::iterator pos;
+    };
+
+    void drop(const std::string& path) {
+        auto it = entries_.find(path);
+        if (it == entries_.end()) return;
+        bytes_ -= it->second.bytes;
+        lru_.erase(it->second.pos);
+        entries_.erase(it);
+    }
+
+    /// Drop least recently used entries until within budget; the most
+    /// recent one stays even if it alone is over
+    void evict() {
+        while (bytes_ > budget_ && lru_.size() > 1) {
+            auto it = entries_.find(lru_.back());
+            bytes_ -= it->second.bytes;
+            entries_.erase(it);
+            lru_.pop_back();
+            ++stats_.evictions;
+        }
+    }
+
+    mutable std::mutex mutex_;
+    size_t budget_;
+    size_t bytes_ = 0;
+    std::filesystem::path compiledDir_;
+    std::list<std::string> lru_;  // most recently used first
+    std::unordered_map<std::string, Entry> entries_;
+    Stats stats_;
+};
+
+} // namespace choreo
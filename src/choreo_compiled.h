@@ -0,0 +1,379 @@
+// choreo_compiled.h
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "choreoparser.h"
+#include "hash.h"
+#include "logger.h"
+#include "mapped_file.h"
+
+namespace choreo {
+
+// ------------------------
+// Compiled choreography files
+// ------------------------
+// A parsed Timeline written out as-is (slot times, slot offsets/counts and
+// the pre-encoded OSC payloads, which already carry their address strings)
+// plus the normalized Match patterns. Loading maps the file and points the
+// Timeline straight at it, so an unchanged choreography costs a stat and the
+// page faults of the slots actually played instead of a TSV parse.
+//
+// A compiled file is valid for its source while the size and mtime match;
+// if only the mtime differs (touched, copied, checked out again) the source
+// content hash decides, and a match stamps the new mtime into the compiled
+// file so later loads don't hash again.
+//
+// Compiled files are mapped and trusted as they are, so they live in a
+// directory only the user can write: by default a per-user cache directory,
+// created with mode 0700, and always written through a fresh temporary file
+// that is renamed into place.
+//
+// Layout: Header, then 8-byte aligned sections
+//   times   double[slots]
+//   offsets uint32[slots + 1]
+//   counts  uint32[slots]
+//   packets char[packetBytes]
+//   patterns uint32 titleCount, uint32 artistCount, then per string
+//            uint32 length + bytes
+
+class ChoreoCompiled {
+public:
+    static constexpr uint32_t kVersion = 1;
+
+    /// Identity of a source file
+    struct SourceKey {
+        uint64_t size  = 0;
+        int64_t  mtime = 0;
+        uint64_t hash  = 0;  // only filled in by hashSource()
+    };
+
+    /// Size and mtime of `source`; false if it can't be stat'ed
+    static bool statSource(const std::string& source, SourceKey& key) {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(source, ec);
+        if (ec) return false;
+        auto mtime = std::filesystem::last_write_time(source, ec);
+        if (ec) return false;
+        key.size  = size;
+        key.mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+        return true;
+    }
+
+    /// FNV-1a of the whole source file
+    static bool hashSource(const std::string& source, SourceKey& key) {
+        std::ifstream in(source, std::ios::binary);
+        if (!in) return false;
+        char buf[1 << 16];
+        uint64_t h = fnv1a(nullptr, 0);
+        while (in.read(buf, sizeof(buf)) || in.gcount() > 0)
+            h = fnv1a(buf, static_cast<size_t>(in.gcount()), h);
+        key.hash = h;
+        return true;
+    }
+
+    /// Per-user default for the compiled directory: %LOCALAPPDATA% on
+    /// Windows, $XDG_CACHE_HOME or ~/.cache elsewhere
+    static std::filesystem::path defaultCacheDir() {
+#ifdef _WIN32
+        if (const char* local = std::getenv("LOCALAPPDATA"); local && *local)
+            return std::filesystem::path(local) / "rkbx_choreographer" / "compiled";
+#else
+        if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+            return std::filesystem::path(xdg) / "rkbx_choreographer" / "compiled";
+        if (const char* home = std::getenv("HOME"); home && *home)
+            return std::filesystem::path(home) / ".cache" / "rkbx_choreographer" / "compiled";
+#endif
+        std::error_code ec;
+        return std::filesystem::temp_directory_path(ec) / "rkbx_choreographer" / "compiled";
+    }
+
+    /// Create `dir` if needed (mode 0700) and check it is a real directory
+    /// that only the current user can write to. False, with a warning, if not.
+    static bool prepareCacheDir(const std::filesystem::path& dir) {
+        std::error_code ec;
+        if (dir.has_parent_path()) std::filesystem::create_directories(dir.parent_path(), ec);
+#ifdef _WIN32
+        std::filesystem::create_directory(dir, ec);
+        if (!std::filesystem::is_directory(std::filesystem::symlink_status(dir, ec))) {
+            LOG_WARN("Compiled choreography directory %s is not a directory", dir.string().c_str());
+            return false;
+        }
+#else
+        if (::mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+            LOG_WARN("Cannot create compiled choreography directory %s: %s", dir.c_str(), std::strerror(errno));
+            return false;
+        }
+        struct stat st{};
+        if (::lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != ::geteuid()
+            || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+            LOG_WARN("Compiled choreography directory %s is not a directory owned by and only writable "
+                     "by this user", dir.c_str());
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    /// Where the compiled form of `source` lives under `cacheDir`
+    static std::filesystem::path pathFor(const std::filesystem::path& cacheDir, const std::string& source) {
+        std::error_code ec;
+        auto abs = std::filesystem::absolute(source, ec).generic_string();
+        char hex[17];
+        std::snprintf(hex, sizeof(hex), "%016llx",
+                      static_cast<unsigned long long>(fnv1a(abs.data(), abs.size())));
+        return cacheDir / (std::filesystem::path(source).stem().string() + "_" + hex + ".rkc");
+    }
+
+    /// Map `compiled` if it is valid for `source`; nullptr if it is missing,
+    /// stale or damaged
+    static std::shared_ptr<ChoreoParser> load(const std::filesystem::path& compiled, const std::string& source) {
+        SourceKey key;
+        if (!statSource(source, key)) return nullptr;
+
+        auto file = std::make_shared<MappedFile>();
+        if (!file->open(compiled.string()) || file->size() < sizeof(Header)) return nullptr;
+        Header h;
+        std::memcpy(&h, file->data(), sizeof(h));
+        if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 || h.version != kVersion
+            || h.fileSize != file->size() || h.sourceSize != key.size)
+            return nullptr;
+        bool touched = h.sourceMtime != key.mtime;
+        if (touched && (!hashSource(source, key) || key.hash != h.sourceHash))
+            return nullptr;
+
+        // sections must lie inside the file
+        uint64_t n = h.slotCount;
+        if (!within(h, h.timesOffset, n * sizeof(double))
+            || !within(h, h.offsetsOffset, (n + 1) * sizeof(uint32_t))
+            || !within(h, h.countsOffset, n * sizeof(uint32_t))
+            || !within(h, h.packetsOffset, h.packetBytes)
+            || !within(h, h.patternsOffset, h.patternBytes))
+            return nullptr;
+
+        const char* base = file->data();
+        Timeline t;
+        t.times   = { reinterpret_cast<const double*>(base + h.timesOffset), n };
+        t.offsets = { reinterpret_cast<const uint32_t*>(base + h.offsetsOffset), n + 1 };
+        t.counts  = { reinterpret_cast<const uint32_t*>(base + h.countsOffset), n };
+        t.packets = { base + h.packetsOffset, h.packetBytes };
+        if (!validSlots(t)) return nullptr;
+
+        std::vector<std::string> titles, artists;
+        if (!readPatterns(base + h.patternsOffset, h.patternBytes, titles, artists)) return nullptr;
+
+        // same content under a new mtime: remember the mtime, not worth failing over
+        if (touched) {
+            std::string out(base, file->size());
+            h.sourceMtime = key.mtime;
+            std::memcpy(out.data(), &h, sizeof(h));
+            writeAtomically(compiled, out, true);
+        }
+
+        t.backing = std::move(file);
+        return std::make_shared<ChoreoParser>(std::move(t), std::move(titles), std::move(artists));
+    }
+
+    /// Compile `parser`, parsed from `source`, into `compiled`.
+    /// Written to a temporary file and renamed, so readers never see half a file.
+    static bool write(const std::filesystem::path& compiled, const std::string& source, const ChoreoParser& parser) {
+        SourceKey key;
+        if (!statSource(source, key) || !hashSource(source, key)) return false;
+
+        const Timeline& t = parser.timeline();
+        std::string patterns;
+        appendPatterns(patterns, parser.matchTitles(), parser.matchArtists());
+
+        Header h{};
+        std::memcpy(h.magic, kMagic, sizeof(kMagic));
+        h.version     = kVersion;
+        h.slotCount   = static_cast<uint32_t>(t.size());
+        h.sourceSize  = key.size;
+        h.sourceMtime = key.mtime;
+        h.sourceHash  = key.hash;
+
+        std::string out(sizeof(Header), '\0');
+        auto section = [&out](const void* data, size_t size) {
+            out.resize(align(out.size()), '\0');
+            uint64_t at = out.size();
+            out.append(static_cast<const char*>(data), size);
+            return at;
+        };
+        h.timesOffset    = section(t.times.data(), t.times.size_bytes());
+        h.offsetsOffset  = section(t.offsets.data(), t.offsets.size_bytes());
+        h.countsOffset   = section(t.counts.data(), t.counts.size_bytes());
+        h.packetsOffset  = section(t.packets.data(), t.packets.size_bytes());
+        h.packetBytes    = t.packets.size_bytes();
+        h.patternsOffset = section(patterns.data(), patterns.size());
+        h.patternBytes   = patterns.size();
+        h.fileSize       = out.size();
+        std::memcpy(out.data(), &h, sizeof(h));
+
+        return writeAtomically(compiled, out);
+    }
+
+private:
+    static constexpr char kMagic[4] = { 'R', 'K', 'C', 'B' };
+
+    struct Header {
+        char     magic[4];
+        uint32_t version;
+        uint64_t sourceSize;
+        int64_t  sourceMtime;
+        uint64_t sourceHash;
+        uint64_t fileSize;
+        uint32_t slotCount;
+        uint32_t reserved;
+        uint64_t timesOffset, offsetsOffset, countsOffset;
+        uint64_t packetsOffset, packetBytes;
+        uint64_t patternsOffset, patternBytes;
+    };
+
+    /// Write `data` to a new, uniquely named temporary file next to `target`
+    /// (never following or reusing anything already there) and rename it
+    /// over `target`. `quiet` logs failures at debug level only.
+    static bool writeAtomically(const std::filesystem::path& target, const std::string& data, bool quiet = false) {
+        auto level = quiet ? rklog::Level::Debug : rklog::Level::Warn;
+        std::filesystem::path tmp;
+        bool written = false;
+#ifdef _WIN32
+        std::random_device rd;
+        for (int attempt = 0; attempt < 8 && tmp.empty(); ++attempt) {
+            char suffix[32];
+            std::snprintf(suffix, sizeof(suffix), ".%08x%08x.tmp", rd(), rd());
+            auto candidate = target;
+            candidate += suffix;
+            HANDLE f = CreateFileW(candidate.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_NEW,
+                                   FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (f == INVALID_HANDLE_VALUE) continue;
+            tmp = candidate;
+            DWORD n = 0;
+            written = WriteFile(f, data.data(), static_cast<DWORD>(data.size()), &n, nullptr)
+                   && n == data.size();
+            CloseHandle(f);
+        }
+#else
+        std::string name = target.string() + ".XXXXXX";
+        int fd = ::mkstemp(name.data());
+        if (fd >= 0) {
+            tmp = name;
+            size_t done = 0;
+            while (done < data.size()) {
+                ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                done += static_cast<size_t>(n);
+            }
+            written = done == data.size();
+            written = ::close(fd) == 0 && written;
+        }
+#endif
+        if (tmp.empty()) {
+            rklog::Logger::instance().log(level, "Cannot create a temporary file for %s", target.string().c_str());
+            return false;
+        }
+        std::error_code ec;
+        if (!written) {
+            rklog::Logger::instance().log(level, "Cannot write compiled choreography %s", tmp.string().c_str());
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+        std::filesystem::rename(tmp, target, ec);
+        if (ec) {
+            rklog::Logger::instance().log(level, "Cannot replace %s: %s", target.string().c_str(),
+                                          ec.message().c_str());
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+        return true;
+    }
+
+    static size_t align(size_t n) { return (n + 7) & ~size_t(7); }
+
+    static bool within(const Header& h, uint64_t offset, uint64_t size) {
+        return offset % 8 == 0 && offset <= h.fileSize && size <= h.fileSize - offset;
+    }
+
+    /// Every slot must be a run of exactly counts[i] whole elements filling
+    /// packets[offsets[i], offsets[i+1]), so playback never walks past the
+    /// mapping however the file was damaged
+    static bool validSlots(const Timeline& t) {
+        size_t n = t.size();
+        if (t.offsets[0] != 0 || t.offsets[n] != t.packets.size()) return false;
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t begin = t.offsets[i], end = t.offsets[i + 1];
+            if (end < begin || end > t.packets.size() || (i && !(t.times[i - 1] < t.times[i]))) return false;
+            uint32_t count = 0;
+            for (size_t e = begin; e < end; ++count) {
+                if (end - e < 4) return false;
+                size_t size = elementSize(t.packets.data() + e);
+                if (size == 0 || size % 4 != 0 || size > end - e - 4) return false;
+                e += 4 + size;
+            }
+            if (count != t.counts[i]) return false;
+        }
+        return true;
+    }
+
+    static void appendU32(std::string& out, uint32_t v) { out.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+
+    static void appendPatterns(std::string& out, const std::vector<std::string>& titles,
+                               const std::vector<std::string>& artists) {
+        appendU32(out, static_cast<uint32_t>(titles.size()));
+        appendU32(out, static_cast<uint32_t>(artists.size()));
+        for (const auto* list : { &titles, &artists }) {
+            for (const auto& s : *list) {
+                appendU32(out, static_cast<uint32_t>(s.size()));
+                out += s;
+            }
+        }
+    }
+
+    static bool readPatterns(const char* p, size_t size, std::vector<std::string>& titles,
+                             std::vector<std::string>& artists) {
+        const char* end = p + size;
+        auto u32 = [&p, end](uint32_t& v) {
+            if (end - p < 4) return false;
+            std::memcpy(&v, p, 4);
+            p += 4;
+            return true;
+        };
+        uint32_t counts[2];
+        if (!u32(counts[0]) || !u32(counts[1])) return false;
+        std::vector<std::string>* lists[2] = { &titles, &artists };
+        for (int l = 0; l < 2; ++l) {
+            for (uint32_t i = 0; i < counts[l]; ++i) {
+                uint32_t len;
+                if (!u32(len) || static_cast<size_t>(end - p) < len) return false;
+                lists[l]->emplace_back(p, len);
+                p += len;
+            }
+        }
+        return true;
+    }
+};
+
+} // namespace choreo
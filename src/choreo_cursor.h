@@ -0,0 +1,242 @@
+// choreo_cursor.h
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "beat_utils.h"
+#include "choreoparser.h"
+#include "logger.h"
+#include "oscpacket.h"
+
+namespace choreo {
+
+// ------------------------
+// Playback cursor
+// ------------------------
+// Playback state over one ChoreoParser's timeline. The parser itself is
+// immutable once built, so the same choreography can be played by several
+// cursors at once (e.g. the same track on both decks) and swapped out by a
+// hot reload without touching anyone else's position.
+
+class ChoreoCursor {
+public:
+    /// Play `choreo` (nullptr detaches). The cursor is repositioned on the next update.
+    void attach(std::shared_ptr<const ChoreoParser> choreo) {
+        choreo_ = std::move(choreo);
+        timeline_ = choreo_ ? &choreo_->timeline() : nullptr;
+        sentTags_.assign(timeline_ ? timeline_->size() : 0, 0);
+        nextIndex_ = inflightBegin_ = 0;
+        positioned_ = false;
+    }
+
+    const std::shared_ptr<const ChoreoParser>& choreo() const { return choreo_; }
+    explicit operator bool() const { return timeline_ != nullptr; }
+
+    /// Update by beat position. deltaBeat in beats
+    /// Appends the pre-encoded messages due in the window to `p`.
+    /// Returns true if any were added.
+    ///
+    /// A playback cursor remembers which slots already fired, so while the
+    /// beat moves forward each slot fires exactly once and the cursor only
+    /// steps over what is due. Moving back by more than the seek-back
+    /// threshold, or jumping ahead by more than the seek-forward threshold,
+    /// counts as a seek/loop and repositions the cursor with a binary search.
+    bool update(int beat, double frac,
+         double deltaBeat,
+         PacketBuilder& p)
+    {
+        // deltabeat usually around 0.4
+        double cur = beat + frac;
+        double w1  = cur + deltaBeat;
+
+        follow(cur, w1);
+
+        // Send all slots up to the end of the window that have not fired yet
+        size_t first = nextIndex_;
+        double t;
+        while (due(w1, t)) fire(p);
+        return nextIndex_ != first;
+    }
+
+    /// Lookahead variant of update(): slots up to `lookaheadBeats` ahead are
+    /// sent early, each in a bundle stamped with the time tag of its beat
+    /// position according to `clock`. Slots already sent but not yet due are
+    /// re-sent with a corrected tag when the predicted time moved by more than
+    /// the resend tolerance (BPM change, nudge, offset change).
+    ///
+    /// OSC has no way to retract a bundle, so a bundle already queued at the
+    /// receiver still executes; the correction relies on choreography messages
+    /// being absolute (select/connect/set) so a repeat is harmless. After a
+    /// seek the in-flight set is dropped and playback continues from the new
+    /// position.
+    bool updateLookahead(int beat, double frac,
+         double lookaheadBeats,
+         const TimeTagClock& clock,
+         PacketBuilder& p)
+    {
+        double cur = beat + frac;
+        double w1  = cur + lookaheadBeats;
+
+        follow(cur, w1);
+        if (!timeline_) return false;
+
+        size_t before = p.pending();
+
+        // slots whose time has come are out of our hands
+        while (inflightBegin_ < nextIndex_ && timeline_->times[inflightBegin_] <= cur)
+            ++inflightBegin_;
+
+        // re-stamp in-flight slots whose predicted time moved
+        for (size_t i = inflightBegin_; i < nextIndex_; ++i) {
+            uint64_t tag = clock.at(timeline_->times[i]);
+            if (TimeTagClock::distance(tag, sentTags_[i]) > resendToleranceSec_) {
+                p.appendTimed(tag, timeline_->slotData(i), timeline_->slotSize(i), timeline_->counts[i]);
+                sentTags_[i] = tag;
+            }
+        }
+
+        // slots entering the lookahead window
+        while (nextIndex_ < timeline_->size() && timeline_->times[nextIndex_] <= w1) {
+            uint64_t tag = clock.at(timeline_->times[nextIndex_]);
+            p.appendTimed(tag, timeline_->slotData(nextIndex_), timeline_->slotSize(nextIndex_),
+                          timeline_->counts[nextIndex_]);
+            sentTags_[nextIndex_] = tag;
+            printSlot(nextIndex_);
+            ++nextIndex_;
+        }
+        return p.pending() != before;
+    }
+
+    /// Step API for merging several cursors into one packet: after follow(),
+    /// due() reports the beat time of the next slot inside the window ending
+    /// at `w1` and fire() appends it and moves on.
+    bool due(double w1, double& time) const {
+        if (!timeline_ || nextIndex_ >= timeline_->size() || timeline_->times[nextIndex_] > w1)
+            return false;
+        time = timeline_->times[nextIndex_];
+        return true;
+    }
+
+    void fire(PacketBuilder& p) {
+        p.append(timeline_->slotData(nextIndex_), timeline_->slotSize(nextIndex_),
+                 timeline_->counts[nextIndex_]);
+        printSlot(nextIndex_);
+        ++nextIndex_;
+    }
+
+    /// Re-send an in-flight slot only if its time moved by more than this
+    void setResendTolerance(double seconds) { resendToleranceSec_ = seconds; }
+
+    /// Position the cursor so the next update fires slots at or after `beatPos`
+    void seek(double beatPos) {
+        if (!timeline_) return;
+        auto it = std::lower_bound(timeline_->times.begin(), timeline_->times.end(), beatPos);
+        nextIndex_  = it - timeline_->times.begin();
+        inflightBegin_ = nextIndex_;
+        lastBeat_   = beatPos;
+        sentUpTo_   = beatPos;
+        positioned_ = true;
+    }
+
+    /// Beat time of the next slot the cursor will fire, if any
+    bool nextTime(double& beatPos) const {
+        if (!timeline_ || !positioned_ || nextIndex_ >= timeline_->size()) return false;
+        beatPos = timeline_->times[nextIndex_];
+        return true;
+    }
+
+    /// Forget the cursor; the next update positions it at the current beat
+    void reset() { positioned_ = false; }
+
+    /// Seek detection: backwards by more than `backBeats` or forwards past the
+    /// last window by more than `forwardBeats` re-positions instead of
+    /// replaying/skipping through the slots in between
+    void setSeekThresholds(double backBeats, double forwardBeats) {
+        seekBackBeats_    = backBeats;
+        seekForwardBeats_ = forwardBeats;
+    }
+
+    /// Wrapper by time in seconds (delta in sec, bpm)
+    bool updateWithTime(double currentTimeSec,
+                double deltaTimeSec,
+                double bpm,
+                PacketBuilder& p)
+    {
+        double beatNumberNow = timeToBeatNumber(currentTimeSec, bpm);
+        int    beatInt    = static_cast<int>(std::floor(beatNumberNow));
+        double beatFrac   = beatNumberNow - beatInt;
+        double deltaBeats = deltaTimeSec * bpm / 60.0;
+        return update(beatInt, beatFrac, deltaBeats, p);
+    }
+
+    /// Wrapper with int beat, double frac, and delta in seconds
+    bool updateWithMixed(int beat, double frac,
+            double deltaTimeSec, double bpm,
+            PacketBuilder& p)
+    {
+        double deltaBeats = deltaTimeSec * bpm / 60.0;
+        return update(beat, frac, deltaBeats, p);
+    }
+
+    /// Track the beat position for seek detection; re-positions the cursor
+    /// when `cur` looks like a seek or loop rather than normal playback
+    void follow(double cur, double w1) {
+        if (!timeline_) return;
+        if (!positioned_
+            || cur < lastBeat_ - seekBackBeats_
+            || cur > sentUpTo_ + seekForwardBeats_) {
+            seek(cur);
+        }
+        lastBeat_ = cur;
+        if (w1 > sentUpTo_) sentUpTo_ = w1;
+    }
+
+    /// follow() for a deck that is not being played: steps over the slots
+    /// before `cur` without sending them, so the deck can start playing from
+    /// where it is without a seek and without a burst of skipped slots
+    void pass(double cur) {
+        follow(cur, cur);
+        if (!timeline_) return;
+        while (nextIndex_ < timeline_->size() && timeline_->times[nextIndex_] < cur) ++nextIndex_;
+        inflightBegin_ = nextIndex_;
+    }
+
+private:
+    std::shared_ptr<const ChoreoParser> choreo_;
+    const Timeline* timeline_ = nullptr;
+
+    // playback cursor
+    size_t nextIndex_   = 0;     // first slot that has not fired this pass
+    double lastBeat_    = 0.0;   // beat position seen by the previous update
+    double sentUpTo_    = 0.0;   // end of the furthest window dispatched so far
+    bool   positioned_  = false;
+    // lookahead mode: slots [inflightBegin_, nextIndex_) were sent with a
+    // future time tag, sentTags_[i] being the tag slot i went out with
+    size_t inflightBegin_ = 0;
+    std::vector<uint64_t> sentTags_;
+    double resendToleranceSec_ = 0.005;
+    // positions from BeatPhaseTracker only move forward between resyncs, so
+    // a step back is an offset nudge (milliseconds) or a Rekordbox loop or
+    // seek; anything larger than a nudge re-positions, which lets loops down
+    // to a quarter beat replay their slots
+    double seekBackBeats_    = 0.25;
+    double seekForwardBeats_ = 8.0;
+
+    void printSlot(size_t i) const {
+        if (!rklog::Logger::instance().enabled(rklog::Level::Info)) return;
+        const char* e   = timeline_->slotData(i);
+        const char* end = e + timeline_->slotSize(i);
+        char text[160];
+        for (; e < end; e += 4 + elementSize(e)) {
+            describeElement(e, text, sizeof(text));
+            LOG_INFO("OSC: %s", text);
+        }
+    }
+};
+
+} // namespace choreo
@@ -0,0 +1,137 @@
+// choreo_index.h
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "choreoparser.h"
+
+namespace choreo {
+
+// ------------------------
+// Track → choreography index
+// ------------------------
+// Every `Match Song` pattern of every file header, normalized once at scan
+// time, keyed by title. A lookup normalizes the track once, hashes to the
+// files listing that title and verifies the artist against each of them, so
+// its cost doesn't grow with the size of the library. Among several files
+// matching the same track the one added first wins, as with a linear scan.
+// A file keeps its place for the whole session: removing it leaves its slot
+// (path only) behind, which the file takes back if it is created again.
+
+class ChoreoIndex {
+public:
+    /// Lookup timings
+    struct Stats {
+        uint64_t lookups = 0;
+        uint64_t hits    = 0;
+        double   lastUs  = 0.0;
+        double   totalUs = 0.0;
+        double   maxUs   = 0.0;
+        double meanUs() const { return lookups ? totalUs / lookups : 0.0; }
+    };
+
+    void clear() {
+        byTitle_.clear();
+        headers_.clear();
+        live_.clear();
+    }
+
+    /// Register every title pattern of `header`
+    void add(ChoreoHeader header) {
+        size_t id = headers_.size();
+        headers_.push_back(std::move(header));
+        live_.push_back(true);
+        link(id);
+    }
+
+    /// Replace the header of the same path, or revive its removed slot
+    /// (keeping its precedence either way), or add it
+    void update(ChoreoHeader header) {
+        for (size_t id = 0; id < headers_.size(); ++id) {
+            if (headers_[id].path != header.path) continue;
+            if (live_[id]) unlink(id);
+            headers_[id] = std::move(header);
+            live_[id] = true;
+            link(id);
+            return;
+        }
+        add(std::move(header));
+    }
+
+    /// Forget the patterns of the file at `path`; its slot stays reserved
+    /// for the path
+    void remove(const std::string& path) {
+        for (size_t id = 0; id < headers_.size(); ++id) {
+            if (headers_[id].path != path || !live_[id]) continue;
+            unlink(id);
+            headers_[id] = ChoreoHeader{ path, {}, {} };
+            live_[id] = false;
+            return;
+        }
+    }
+
+    /// Header of the file whose patterns match the track, nullptr if none
+    const ChoreoHeader* find(const std::string& artist, const std::string& title) {
+        auto start = std::chrono::steady_clock::now();
+        const ChoreoHeader* found = nullptr;
+        auto it = byTitle_.find(ChoreoParser::normalize(title));
+        if (it != byTitle_.end()) {
+            auto normArtist = ChoreoParser::normalize(artist);
+            for (size_t id : it->second) {
+                const auto& artists = headers_[id].artists;
+                if (std::find(artists.begin(), artists.end(), normArtist) != artists.end()) {
+                    found = &headers_[id];
+                    break;
+                }
+            }
+        }
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        ++stats_.lookups;
+        if (found) ++stats_.hits;
+        stats_.lastUs = us;
+        stats_.totalUs += us;
+        stats_.maxUs = std::max(stats_.maxUs, us);
+        return found;
+    }
+
+    size_t titleCount() const { return byTitle_.size(); }
+    size_t fileCount() const { return static_cast<size_t>(std::count(live_.begin(), live_.end(), true)); }
+    const Stats& stats() const { return stats_; }
+
+private:
+    /// Enter header `id` under each of its titles, keeping every list in id
+    /// (= precedence) order
+    void link(size_t id) {
+        const auto& titles = headers_[id].titles;
+        for (size_t i = 0; i < titles.size(); ++i) {
+            // the same title listed twice in one file needs one entry
+            if (std::find(titles.begin(), titles.begin() + i, titles[i]) != titles.begin() + i)
+                continue;
+            auto& ids = byTitle_[titles[i]];
+            ids.insert(std::upper_bound(ids.begin(), ids.end(), id), id);
+        }
+    }
+
+    void unlink(size_t id) {
+        for (const auto& title : headers_[id].titles) {
+            auto it = byTitle_.find(title);
+            if (it == byTitle_.end()) continue;
+            auto& ids = it->second;
+            ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+            if (ids.empty()) byTitle_.erase(it);
+        }
+    }
+
+    std::unordered_map<std::string, std::vector<size_t>> byTitle_;
+    std::vector<ChoreoHeader> headers_;
+    std::vector<bool> live_;  // false: removed, slot kept for its path
+    Stats stats_;
+};
+
+} // namespace choreo
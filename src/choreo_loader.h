@@ -0,0 +1,136 @@
+// choreo_loader.h
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "choreoparser.h"
+
+namespace choreo {
+
+// ------------------------
+// Background choreography loading
+// ------------------------
+// Finding the choreography of a newly loaded track means an index lookup
+// and, on a cache miss, mapping or parsing its file: milliseconds for a
+// large TSV, which the dispatcher can't spend between two slots. It posts
+// the track instead and carries on; a loader thread resolves it and
+// publishes the result the way ChoreoWatcher publishes reloads, as an
+// immutable batch behind an atomic shared_ptr that the dispatcher collects
+// with take() and only has to attach.
+
+/// A deck's track to resolve
+struct ChoreoLoadRequest {
+    int deck = 0;
+    uint64_t generation = 0;  // the deck's track change this is for
+    std::string artist, title;
+};
+
+/// Its outcome; no parser if the track has no (loadable) choreography
+struct ChoreoLoad {
+    int deck = 0;
+    uint64_t generation = 0;
+    std::string path;
+    std::shared_ptr<ChoreoParser> parser;
+};
+
+using ChoreoLoadBatch = std::vector<ChoreoLoad>;
+
+class ChoreoLoader {
+public:
+    /// Resolves artist/title to a parser, setting the path it came from
+    using Resolve = std::function<std::shared_ptr<ChoreoParser>(const std::string& artist,
+                                                                const std::string& title,
+                                                                std::string& path)>;
+
+    explicit ChoreoLoader(Resolve resolve) : resolve_(std::move(resolve)) {
+        thread_ = std::thread([this] { run(); });
+    }
+
+    ~ChoreoLoader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        thread_.join();
+    }
+
+    ChoreoLoader(const ChoreoLoader&) = delete;
+    ChoreoLoader& operator=(const ChoreoLoader&) = delete;
+
+    /// Queue a track; only holds the lock to append it
+    void post(ChoreoLoadRequest request) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            requests_.push_back(std::move(request));
+        }
+        wake_.notify_one();
+    }
+
+    /// Loads published since the last call, nullptr if none
+    std::shared_ptr<const ChoreoLoadBatch> take() {
+        if (!published_.load(std::memory_order_relaxed)) return nullptr;
+        return published_.exchange(nullptr, std::memory_order_acq_rel);
+    }
+
+    /// Block until everything posted so far has been published
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this] { return requests_.empty() && !busy_; });
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            wake_.wait(lock, [this] { return stop_ || !requests_.empty(); });
+            if (stop_) return;
+            ChoreoLoadRequest request = std::move(requests_.front());
+            requests_.pop_front();
+            busy_ = true;
+            lock.unlock();
+
+            ChoreoLoad load;
+            load.deck       = request.deck;
+            load.generation = request.generation;
+            load.parser     = resolve_(request.artist, request.title, load.path);
+            publish(std::move(load));
+
+            lock.lock();
+            busy_ = false;
+            if (requests_.empty()) idle_.notify_all();
+        }
+    }
+
+    /// Append to whatever the dispatcher hasn't taken yet
+    void publish(ChoreoLoad load) {
+        auto cur = published_.load(std::memory_order_acquire);
+        std::shared_ptr<const ChoreoLoadBatch> next;
+        do {
+            auto merged = std::make_shared<ChoreoLoadBatch>();
+            if (cur) *merged = *cur;
+            merged->push_back(load);
+            next = std::move(merged);
+        } while (!published_.compare_exchange_weak(cur, next, std::memory_order_acq_rel));
+    }
+
+    Resolve resolve_;
+    std::mutex mutex_;
+    std::condition_variable wake_, idle_;
+    std::deque<ChoreoLoadRequest> requests_;
+    bool busy_ = false;
+    bool stop_ = false;
+    std::thread thread_;
+    std::atomic<std::shared_ptr<const ChoreoLoadBatch>> published_;
+};
+
+} // namespace choreo
@@ -0,0 +1,180 @@
+// choreo_watcher.h
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "choreoparser.h"
+#include "logger.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace choreo {
+
+// ------------------------
+// Choreography hot reload
+// ------------------------
+// A watcher thread follows the choreography folder with inotify and re-parses
+// a .tsv once writes to it have settled. Each finished reload is published as
+// an immutable batch through an atomic shared_ptr; the owner of the playback
+// state collects it with take(), a single atomic exchange that never blocks,
+// and swaps the new timelines in on its own thread. Files that fail to parse
+// are reported and leave the previous version in place.
+// Only Linux has a watcher; elsewhere start() reports that and does nothing.
+
+/// One file that changed on disk
+struct ChoreoReload {
+    std::string path;
+    bool removed = false;
+    ChoreoHeader header;                   // valid unless removed
+    std::shared_ptr<ChoreoParser> parser;  // valid unless removed
+};
+
+using ChoreoReloadBatch = std::vector<ChoreoReload>;
+
+class ChoreoWatcher {
+public:
+    ChoreoWatcher() = default;
+    ~ChoreoWatcher() { stop(); }
+    ChoreoWatcher(const ChoreoWatcher&) = delete;
+    ChoreoWatcher& operator=(const ChoreoWatcher&) = delete;
+
+    /// Start watching `folder`; false if hot reload isn't available
+    bool start(const std::string& folder) {
+#ifdef __linux__
+        fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd_ < 0) {
+            LOG_WARN("Choreography hot reload unavailable: %s", std::strerror(errno));
+            return false;
+        }
+        if (inotify_add_watch(fd_, folder.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0) {
+            LOG_WARN("Cannot watch %s: %s", folder.c_str(), std::strerror(errno));
+            close(fd_);
+            fd_ = -1;
+            return false;
+        }
+        folder_ = folder;
+        running_ = true;
+        thread_ = std::thread([this] { run(); });
+        LOG_INFO("Watching %s for choreography changes", folder.c_str());
+        return true;
+#else
+        (void)folder;
+        LOG_INFO("Choreography hot reload is only available on Linux");
+        return false;
+#endif
+    }
+
+    void stop() {
+#ifdef __linux__
+        running_ = false;
+        if (thread_.joinable()) thread_.join();
+        if (fd_ >= 0) close(fd_);
+        fd_ = -1;
+#endif
+    }
+
+    /// Reloads published since the last call, nullptr if none
+    std::shared_ptr<const ChoreoReloadBatch> take() {
+        if (!published_.load(std::memory_order_relaxed)) return nullptr;
+        return published_.exchange(nullptr, std::memory_order_acq_rel);
+    }
+
+private:
+    /// Append to whatever the consumer hasn't taken yet
+    void publish(ChoreoReloadBatch batch) {
+        auto cur = published_.load(std::memory_order_acquire);
+        std::shared_ptr<const ChoreoReloadBatch> next;
+        do {
+            auto merged = std::make_shared<ChoreoReloadBatch>();
+            if (cur) *merged = *cur;
+            merged->insert(merged->end(), batch.begin(), batch.end());
+            next = std::move(merged);
+        } while (!published_.compare_exchange_weak(cur, next, std::memory_order_acq_rel));
+    }
+
+#ifdef __linux__
+    void run() {
+        // editors write in bursts; wait for this long without events
+        constexpr int kSettleMs = 50;
+        std::set<std::string> changed, removed;
+        alignas(inotify_event) char buf[16 * (sizeof(inotify_event) + NAME_MAX + 1)];
+        while (running_) {
+            pollfd pfd{ fd_, POLLIN, 0 };
+            int ready = poll(&pfd, 1, changed.empty() && removed.empty() ? 100 : kSettleMs);
+            if (ready > 0) {
+                ssize_t n;
+                while ((n = read(fd_, buf, sizeof(buf))) > 0) {
+                    for (char* p = buf; p < buf + n;) {
+                        auto* ev = reinterpret_cast<inotify_event*>(p);
+                        p += sizeof(inotify_event) + ev->len;
+                        if (!ev->len) continue;
+                        std::string name = ev->name;
+                        if (name.size() < 4 || name.compare(name.size() - 4, 4, ".tsv") != 0) continue;
+                        std::string path = (std::filesystem::path(folder_) / name).string();
+                        if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                            changed.erase(path);
+                            removed.insert(path);
+                        } else {
+                            removed.erase(path);
+                            changed.insert(path);
+                        }
+                    }
+                }
+                continue;
+            }
+            if (ready == 0 && (!changed.empty() || !removed.empty())) {
+                reload(changed, removed);
+                changed.clear();
+                removed.clear();
+            }
+        }
+    }
+
+    void reload(const std::set<std::string>& changed, const std::set<std::string>& removed) {
+        ChoreoReloadBatch batch;
+        for (const auto& path : removed) {
+            ChoreoReload r;
+            r.path = path;
+            r.removed = true;
+            batch.push_back(std::move(r));
+        }
+        for (const auto& path : changed) {
+            auto start = std::chrono::steady_clock::now();
+            try {
+                ChoreoReload r;
+                r.path   = path;
+                r.header = ChoreoParser::readHeader(path);
+                r.parser = std::make_shared<ChoreoParser>(path);
+                batch.push_back(std::move(r));
+                LOG_INFO("Reloaded choreography %s in %.2f ms", path.c_str(),
+                         std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            } catch (const std::exception& e) {
+                LOG_ERROR("Error reloading %s, keeping the previous version: %s", path.c_str(), e.what());
+            }
+        }
+        if (!batch.empty()) publish(std::move(batch));
+    }
+
+    int fd_ = -1;
+    std::string folder_;
+    std::atomic<bool> running_{ false };
+    std::thread thread_;
+#endif
+    std::atomic<std::shared_ptr<const ChoreoReloadBatch>> published_;
+};
+
+} // namespace choreo
@@ -1,14 +1,23 @@
 #pragma once
+#include <array>
 #include <string>
 #include <vector>
 #include <memory>
 #include <filesystem>
-#include <iostream>
 #include <chrono>
+#include <mutex>
 #include "osc/OscOutboundPacketStream.h"
 #include "ip/UdpSocket.h"
 #include "ip/IpEndpointName.h"
 #include "choreoparser.h"
+#include "choreo_cursor.h"
+#include "choreo_index.h"
+#include "choreo_cache.h"
+#include "choreo_loader.h"
+#include "choreo_watcher.h"
+#include "histogram.h"
+#include "thread_pool.h"
+#include "logger.h"
 
 #include "beat_utils.h"
 
@@ -17,6 +26,7 @@ using namespace osc;
 class Choreographer {
 public:
     Choreographer(const std::string& choreoFolder = "") {
+        away_.reserve(64);
         if (!choreoFolder.empty()) {
             loadChoreoFiles(choreoFolder);
         }
@@ -33,13 +43,38 @@ public:
         unsigned short port = static_cast<unsigned short>(std::stoi(dst_addr.substr(sep + 1)));
         IpEndpointName endpoint(host.c_str(), port);
         oscSocket = new UdpTransmitSocket(endpoint);
-        std::cout << "OSC on " << host << ":" << port << "\n";
+        packet_.setSink([this](const char* data, std::size_t size) {
+            oscSocket->Send(data, size);
+        });
+        LOG_INFO("OSC on %s:%u", host.c_str(), port);
         return true;
     }
 
+    /// Send deck `deck`'s choreography to its own OSC target instead of the
+    /// shared one (e.g. one Resolume instance per deck)
+    bool setupDeckOsc(int deck, const std::string& dst_addr) {
+        if (deck < 0 || deck >= kDecks) return false;
+        auto sep = dst_addr.find(':');
+        if (sep == std::string::npos) return false;
+        std::string host = dst_addr.substr(0, sep);
+        unsigned short port = static_cast<unsigned short>(std::stoi(dst_addr.substr(sep + 1)));
+        Deck& d = decks_[deck];
+        d.socket = std::make_unique<UdpTransmitSocket>(IpEndpointName(host.c_str(), port));
+        d.packet.setSink([&d](const char* data, std::size_t size) {
+            d.socket->Send(data, size);
+        });
+        LOG_INFO("Deck %d OSC on %s:%u", deck + 1, host.c_str(), port);
+        return true;
+    }
+
+    /// Play the choreographies of all decks at once, each following its own
+    /// deck's beat, instead of only the master deck's
+    void setConcurrentDecks(bool enabled) { concurrent_ = enabled; }
+
     // Callback: New beat occurred
     void onNewBeat(int beatNumber) {
         currentBeat_ = beatNumber;
+        decks_[masterDeck_].beat = beatNumber;
         lastBeatTime_ = std::chrono::high_resolution_clock::now();
         // convert the current beat to bar.beat and print it using beatNumberToBarBeat(currentBeat_);
 
@@ -49,24 +84,131 @@ public:
         //std::cout << "Bar.beat:" << bar << '.' << beat << '\n';
     }
 
+    /// Callback: beat position of a deck, reported every tick before
+    /// onBeatFraction(). Only needed for decks other than the master.
+    void onDeckPosition(int deck, int beat, double fraction) {
+        decks_[deck].beat = beat;
+        decks_[deck].fraction = fraction;
+    }
+
     // Callback: Beat fraction changed
-    void onBeatFraction(float beatFraction, std::chrono::microseconds deltaTime) {
-        if (!oscSocket || !activeChoreo) return;
-        
-        // Calculate delta in beats
-        double deltaBeats = deltaTime.count() * currentBpm_ / 60.0 / 1'000'000.0;
-        
-        char buf[1024];
-        osc::OutboundPacketStream p{ buf, sizeof(buf) };
+    //
+    // Every playing deck (the master, or all of them in concurrent mode)
+    // advances its own cursor against its own beat position. Slots due on
+    // several decks are merged in time order into one datagram per target,
+    // so a tick still builds and sends one packet.
+    //
+    // `now` is the time the beat positions were taken at; a trace replay in
+    // virtual time passes its own clock.
+    void onBeatFraction(double beatFraction, std::chrono::microseconds deltaTime,
+                        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) {
+        auto started = std::chrono::steady_clock::now();
+        lastFraction_ = beatFraction;
+        decks_[masterDeck_].fraction = beatFraction;
+        lastFractionTime_ = now;
+        if (!oscSocket) return;
+
+        // decks with a choreography that aren't playing keep their cursor at
+        // their own position, so a master switch continues without a seek
+        for (int i = 0; i < kDecks; ++i)
+            if (decks_[i].cursor && !playing(i)) decks_[i].cursor.pass(decks_[i].position());
         
-        if (activeChoreo->update(currentBeat_, static_cast<double>(beatFraction), deltaBeats, p)) {
-            oscSocket->Send(p.Data(), p.Size());
-            
-            auto [bar, beat] = beatNumberToBarBeat(currentBeat_);
-                    
-            // Write bar.beat and fraction as separate columns
-            //std::cout << "At:" << bar << '.' << beat << "\n";
+        // Calculate delta in beats. With a dispatch tolerance set the caller
+        // wakes us at each slot's deadline, so only look that far ahead
+        // instead of a whole poll interval.
+        auto window = dispatchTolerance_.count() > 0 ? dispatchTolerance_ : deltaTime;
+        double deltaBeats = window.count() * currentBpm_ / 60.0 / 1'000'000.0;
+
+        if (lookahead_.count() > 0) {
+            // stamp slots with the wall time of their deck's beat position
+            uint64_t tag = choreo::toTimeTag(std::chrono::system_clock::now());
+            double lookaheadBeats = lookahead_.count() * currentBpm_ / 60.0 / 1'000'000.0;
+            for (int i = 0; i < kDecks; ++i) {
+                if (!playing(i)) continue;
+                Deck& d = decks_[i];
+                choreo::TimeTagClock clock;
+                clock.anchorBeat     = d.position();
+                clock.secondsPerBeat = 60.0 / currentBpm_;
+                clock.anchorTag      = tag;
+                d.cursor.updateLookahead(d.beat, d.fraction, lookaheadBeats, clock,
+                                         builderFor(i));
+            }
+        } else {
+            for (int i = 0; i < kDecks; ++i)
+                if (playing(i)) decks_[i].cursor.follow(decks_[i].position(), decks_[i].position() + deltaBeats);
+            // k-way merge: always fire the slot closest to its deck's position
+            for (;;) {
+                int next = -1;
+                double nextAway = 0.0;
+                for (int i = 0; i < kDecks; ++i) {
+                    double t;
+                    if (!playing(i) || !decks_[i].cursor.due(decks_[i].position() + deltaBeats, t)) continue;
+                    double away = t - decks_[i].position();
+                    if (next < 0 || away < nextAway) {
+                        next = i;
+                        nextAway = away;
+                    }
+                }
+                if (next < 0) break;
+                auto away = std::chrono::duration<double>(nextAway * 60.0 / currentBpm_);
+                away_.push_back(std::chrono::duration_cast<std::chrono::steady_clock::duration>(away));
+                decks_[next].cursor.fire(builderFor(next));
+            }
         }
+
+        packet_.flush();
+        for (auto& d : decks_)
+            if (d.socket) d.packet.flush();
+
+        // lateness of each slot: from its ideal time (the tick's clock plus
+        // how far ahead the slot was) to the send returning
+        if (!away_.empty()) {
+            auto sent = std::chrono::steady_clock::now() - started;
+            for (auto away : away_) lateness_.record(sent - away);
+            away_.clear();
+        }
+    }
+
+    /// Ideal time of each slot (from beat position and BPM) to its send
+    /// returning; immediate mode only, lookahead slots carry their time tag
+    const LatencyHistogram& lateness() const { return lateness_; }
+
+    /// Whether any deck is playing a choreography
+    bool active() const {
+        if (!oscSocket) return false;
+        for (int i = 0; i < kDecks; ++i)
+            if (playing(i)) return true;
+        return false;
+    }
+
+    /// Wall-clock deadline of the next choreography slot on any playing deck,
+    /// extrapolated from the last beat positions and the current BPM
+    bool nextDeadline(std::chrono::steady_clock::time_point& when) const {
+        if (!oscSocket || currentBpm_ <= 0.0f) return false;
+        bool found = false;
+        double beatsAway = 0.0;
+        for (int i = 0; i < kDecks; ++i) {
+            double next;
+            if (!playing(i) || !decks_[i].cursor.nextTime(next)) continue;
+            double away = next - decks_[i].position();
+            if (!found || away < beatsAway) beatsAway = away;
+            found = true;
+        }
+        if (!found) return false;
+        auto away = std::chrono::duration<double>(beatsAway * 60.0 / currentBpm_);
+        when = lastFractionTime_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(away)
+             - lookahead_;
+        return true;
+    }
+
+    /// Send slots this far ahead in time-tagged bundles (0 = send immediately)
+    void setLookahead(std::chrono::microseconds lookahead) {
+        lookahead_ = lookahead;
+    }
+
+    /// Fire slots this close ahead of the current position (0 = one poll interval)
+    void setDispatchTolerance(std::chrono::microseconds tolerance) {
+        dispatchTolerance_ = tolerance;
     }
 
     // Callback: BPM changed
@@ -77,49 +219,308 @@ public:
         osc::OutboundPacketStream p{ buf, sizeof(buf) };
         p << osc::BeginMessage("/composition/tempocontroller/tempo") << (bpm-20)/480 << osc::EndMessage; // weird resolume formula
         oscSocket->Send(p.Data(), p.Size());
-        std::cout << "BPM changed to: " << bpm << "\n";
+        LOG_INFO("BPM changed to: %.2f", bpm);
     }
 
-    // Callback: Track/Artist changed on master deck
-    void onMasterTrackChanged(const std::string& artist, const std::string& title) {
-        std::cout << "Master track changed: " << artist << " - " << title << "\n";
-        
-        // Find matching choreo parser
-        activeChoreo = nullptr;
-        for (auto& parser : choreoParsers) {
-            if (parser->matches(artist, title)) {
-                activeChoreo = parser.get();
-                std::cout << "Found matching choreography for: " << artist << " - " << title << "\n";
-                break;
+    /// Callback: the track loaded on a deck changed. Its choreography is
+    /// resolved and loaded right away on the loader thread, so by the time
+    /// the deck becomes master (or starts playing in concurrent mode) it is
+    /// ready; applyReloads() attaches it.
+    void onDeckTrackChanged(int deck, const std::string& artist, const std::string& title) {
+        Deck& d = decks_[deck];
+        if (d.known && artist == d.artist && title == d.title) return;
+        if (deck == masterDeck_)
+            LOG_INFO("Master track changed: %s - %s", artist.c_str(), title.c_str());
+        else
+            LOG_INFO("Deck %d track changed: %s - %s", deck + 1, artist.c_str(), title.c_str());
+        d.cursor.attach(nullptr);
+        d.path.clear();
+        d.artist = artist;
+        d.title = title;
+        d.known = true;
+        loader_.post({ deck, ++d.generation, artist, title });
+    }
+
+    /// Callback: another deck became master. Its choreography was loaded
+    /// when its track was and its cursor has followed the deck since, so
+    /// the switch only changes which cursor fires.
+    void onMasterDeckChanged(int deck) {
+        if (deck == masterDeck_) return;
+        masterDeck_ = deck;
+        Deck& d = decks_[deck];
+        ++masterSwitches_;
+        if (d.cursor) ++readySwitches_;
+        LOG_INFO("Master deck %d: %s - %s%s", deck + 1, d.artist.c_str(), d.title.c_str(),
+                 d.cursor ? "" : ", no choreography");
+    }
+
+    /// Reload choreographies edited in `folderPath` in the background
+    bool watchChoreoFiles(const std::string& folderPath) { return watcher_.start(folderPath); }
+
+    /// Attach the choreographies loaded for new tracks and swap in those the
+    /// watcher re-parsed since the last call. Call from the thread that
+    /// drives playback; costs two atomic exchanges when nothing changed. A
+    /// deck whose file was edited continues the new version from its
+    /// current beat.
+    void applyReloads() {
+        applyLoads();
+        auto batch = watcher_.take();
+        if (!batch) return;
+        std::lock_guard<std::mutex> lock(indexMutex_);
+        for (const auto& r : *batch) {
+            if (r.removed) {
+                index_.remove(r.path);
+                cache_.invalidate(r.path);
+                bool loaded = false;
+                for (const auto& d : decks_) loaded |= d.cursor && r.path == d.path;
+                LOG_INFO("Choreography %s removed%s", r.path.c_str(),
+                         loaded ? ", keeps playing until the track changes" : "");
+                continue;
+            }
+            index_.update(r.header);
+            cache_.put(r.path, r.parser);
+            for (int i = 0; i < kDecks; ++i) {
+                Deck& d = decks_[i];
+                if (d.cursor && r.path == d.path) {
+                    d.cursor.attach(r.parser);
+                    d.cursor.seek(d.position());
+                    LOG_INFO("Deck %d choreography %s swapped at beat %.2f", i + 1, r.path.c_str(), d.position());
+                } else if (!d.cursor && d.known) {
+                    // a track without a choreography may match the new file
+                    const choreo::ChoreoHeader* h = index_.find(d.artist, d.title);
+                    if (h && h->path == r.path) {
+                        d.cursor.attach(r.parser);
+                        d.path = r.path;
+                        ++d.generation;  // supersedes a load still on its way
+                        LOG_INFO("Deck %d now matches choreography %s", i + 1, r.path.c_str());
+                    }
+                }
             }
         }
-        
-        if (!activeChoreo) {
-            std::cout << "No choreography found for: " << artist << " - " << title << "\n";
+    }
+
+    /// Wait for the loader to finish the tracks posted so far and attach
+    /// them; a virtual-time replay calls it so loading can't fall behind a
+    /// trace running faster than real time
+    void finishLoads() {
+        loader_.wait();
+        applyLoads();
+    }
+
+    /// Byte budget of the parsed-choreography LRU
+    void setCacheBudget(size_t bytes) { cache_.setBudget(bytes); }
+
+    /// Directory for compiled choreographies; empty disables them
+    void setCompiledDir(const std::string& dir) { cache_.setCompiledDir(dir); }
+
+    void logStats() const {
+        std::lock_guard<std::mutex> lock(indexMutex_);
+        const auto& st = index_.stats();
+        if (!st.lookups) return;
+        LOG_INFO("Master switches: %llu (%llu to a deck with its choreography loaded)",
+                 static_cast<unsigned long long>(masterSwitches_),
+                 static_cast<unsigned long long>(readySwitches_));
+        LOG_INFO("Choreography lookups: %llu (%llu matched) over %zu titles in %zu files, "
+                 "mean %.1f us, max %.1f us",
+                 static_cast<unsigned long long>(st.lookups), static_cast<unsigned long long>(st.hits),
+                 index_.titleCount(), index_.fileCount(), st.meanUs(), st.maxUs);
+        const auto& cs = cache_.stats();
+        LOG_INFO("Choreography cache: %llu hits, %llu misses (%llu mapped, %llu compiled, "
+                 "%.2f ms loading), %llu evictions, %zu resident using %zu of %zu KiB",
+                 static_cast<unsigned long long>(cs.hits), static_cast<unsigned long long>(cs.misses),
+                 static_cast<unsigned long long>(cs.mapped), static_cast<unsigned long long>(cs.compiled),
+                 cs.parseMs, static_cast<unsigned long long>(cs.evictions),
+                 cache_.size(), cache_.bytes() >> 10, cache_.budget() >> 10);
+    }
+
+    /// Formatting mode: rewrite every choreography in the folder in canonical
+    /// form (blocks sorted and merged), touching only files whose content
+    /// changes. Returns the number of files that failed to parse or write.
+    static size_t formatChoreoFiles(const std::string& folderPath) {
+        size_t written = 0, unchanged = 0, failed = 0;
+        for (const auto& path : listChoreoFiles(folderPath)) {
+            try {
+                switch (choreo::ChoreoParser(path).writeFormatted(path)) {
+                    case choreo::ChoreoParser::FormatResult::Written:
+                        LOG_INFO("Formatted %s", path.c_str());
+                        ++written;
+                        break;
+                    case choreo::ChoreoParser::FormatResult::Unchanged:
+                        ++unchanged;
+                        break;
+                    case choreo::ChoreoParser::FormatResult::Failed:
+                        ++failed;
+                        break;
+                }
+            } catch (const std::exception& e) {
+                LOG_ERROR("Error formatting %s: %s", path.c_str(), e.what());
+                ++failed;
+            }
         }
+        LOG_INFO("Formatted %zu choreography files, %zu already canonical, %zu failed",
+                 written, unchanged, failed);
+        return failed;
     }
 
 private:
-    void loadChoreoFiles(const std::string& folderPath) {
+    /// Find and load the choreography of a track; nullptr if none matches
+    /// or it fails to load. `path` receives the matched file.
+    /// Runs on the loader thread
+    std::shared_ptr<choreo::ChoreoParser> resolve(const std::string& artist, const std::string& title,
+                                                   std::string& path) {
+        path.clear();
+        std::string found;
+        {
+            std::lock_guard<std::mutex> lock(indexMutex_);
+            const choreo::ChoreoHeader* header = index_.find(artist, title);
+            if (!header) {
+                LOG_INFO("No choreography found for: %s - %s (lookup %.1f us)",
+                         artist.c_str(), title.c_str(), index_.stats().lastUs);
+                return nullptr;
+            }
+            LOG_INFO("Found matching choreography for: %s - %s (lookup %.1f us)",
+                     artist.c_str(), title.c_str(), index_.stats().lastUs);
+            found = header->path;
+        }
+        try {
+            auto parser = cache_.get(found);
+            path = found;
+            return parser;
+        } catch (const std::exception& e) {
+            LOG_ERROR("Error loading choreography %s: %s", found.c_str(), e.what());
+            return nullptr;
+        }
+    }
+
+    /// Attach what the loader finished, unless the deck's track changed
+    /// again (or a reload attached it) since it was posted
+    void applyLoads() {
+        auto loads = loader_.take();
+        if (!loads) return;
+        for (const auto& l : *loads) {
+            Deck& d = decks_[l.deck];
+            if (l.generation != d.generation) continue;
+            d.cursor.attach(l.parser);
+            d.path = l.path;
+        }
+    }
+
+    /// .tsv files directly in `folderPath`, sorted
+    static std::vector<std::string> listChoreoFiles(const std::string& folderPath) {
+        std::vector<std::string> paths;
         try {
             for (const auto& entry : std::filesystem::directory_iterator(folderPath)) {
-                if (entry.is_regular_file() && entry.path().extension() == ".tsv") {
-                    std::cout << "Loading choreography: " << entry.path().string() << "\n";
-                    choreoParsers.emplace_back(std::make_unique<choreo::ChoreoParser>(entry.path().string()));
-                }
+                if (entry.is_regular_file() && entry.path().extension() == ".tsv")
+                    paths.push_back(entry.path().string());
             }
-            std::cout << "Loaded " << choreoParsers.size() << " choreography files\n";
         } catch (const std::exception& e) {
-            std::cerr << "Error loading choreo files: " << e.what() << "\n";
+            LOG_ERROR("Error loading choreo files: %s", e.what());
+        }
+        std::sort(paths.begin(), paths.end());
+        return paths;
+    }
+
+    /// Index the Match lines of every file; bodies are parsed on demand.
+    /// Files are read in parallel and indexed in sorted path order, so which
+    /// file wins a duplicate match doesn't depend on directory order or timing.
+    void loadChoreoFiles(const std::string& folderPath) {
+        using clk = std::chrono::steady_clock;
+        auto start = clk::now();
+        std::vector<std::string> paths = listChoreoFiles(folderPath);
+
+        struct Loaded {
+            choreo::ChoreoHeader header;
+            std::string error;
+            double ms = 0.0;
+        };
+        std::vector<Loaded> loaded(paths.size());
+        ThreadPool pool(std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                                         std::max<size_t>(paths.size(), 1)));
+        pool.parallelFor(paths.size(), [&](size_t i) {
+            auto t0 = clk::now();
+            try {
+                loaded[i].header = choreo::ChoreoParser::readHeader(paths[i]);
+            } catch (const std::exception& e) {
+                loaded[i].error = e.what();
+            }
+            loaded[i].ms = std::chrono::duration<double, std::milli>(clk::now() - t0).count();
+        });
+
+        size_t errors = 0, slowest = 0;
+        double sumMs = 0.0;
+        std::lock_guard<std::mutex> lock(indexMutex_);
+        for (size_t i = 0; i < loaded.size(); ++i) {
+            sumMs += loaded[i].ms;
+            if (loaded[i].ms > loaded[slowest].ms) slowest = i;
+            if (!loaded[i].error.empty()) {
+                ++errors;
+                LOG_ERROR("Error indexing %s: %s", paths[i].c_str(), loaded[i].error.c_str());
+                continue;
+            }
+            LOG_DEBUG("Indexed choreography %s in %.3f ms", paths[i].c_str(), loaded[i].ms);
+            index_.add(std::move(loaded[i].header));
         }
+        double totalMs = std::chrono::duration<double, std::milli>(clk::now() - start).count();
+        LOG_INFO("Indexed %zu choreography files (%zu titles, %zu failed) in %.2f ms on %zu threads "
+                 "(%.2f ms of per-file work, %llu stolen)",
+                 index_.fileCount(), index_.titleCount(), errors, totalMs, pool.size(), sumMs,
+                 static_cast<unsigned long long>(pool.steals()));
+        if (!loaded.empty())
+            LOG_INFO("Slowest choreography file: %s (%.3f ms)", paths[slowest].c_str(), loaded[slowest].ms);
+    }
+
+    static constexpr int kDecks = 2;
+
+    /// Track, choreography and beat position of one deck
+    struct Deck {
+        choreo::ChoreoCursor cursor;
+        std::string path, artist, title;
+        bool known = false;  // a track was reported
+        uint64_t generation = 0;  // track changes, to match loads to them
+        int beat = 0;
+        double fraction = 0.0;
+        // own OSC target, if one was set up
+        std::unique_ptr<UdpTransmitSocket> socket;
+        choreo::PacketBuilder packet;
+
+        double position() const { return beat + fraction; }
+    };
+
+    bool playing(int deck) const {
+        return decks_[deck].cursor && (concurrent_ || deck == masterDeck_);
+    }
+
+    choreo::PacketBuilder& builderFor(int deck) {
+        return decks_[deck].socket ? decks_[deck].packet : packet_;
     }
 
     UdpTransmitSocket* oscSocket = nullptr;
-    std::vector<std::unique_ptr<choreo::ChoreoParser>> choreoParsers;
-    choreo::ChoreoParser* activeChoreo = nullptr;
+    choreo::PacketBuilder packet_;
+    mutable std::mutex indexMutex_;  // index_ is shared with the loader thread
+    choreo::ChoreoIndex index_;
+    choreo::ChoreoCache cache_;
+    std::array<Deck, kDecks> decks_;
+    int masterDeck_ = 0;
+    bool concurrent_ = false;
+    uint64_t masterSwitches_ = 0, readySwitches_ = 0;
+    // how far ahead of the tick each slot fired this tick was, recorded
+    // once they are sent; keeps its capacity, so only a tick with more
+    // slots than any before it allocates
+    std::vector<std::chrono::steady_clock::duration> away_;
+    LatencyHistogram lateness_;
+    choreo::ChoreoWatcher watcher_;
     
     // Beat tracking
     int currentBeat_ = 0;
     float currentBpm_ = 120.0f;
+    double lastFraction_ = 0.0;
+    std::chrono::steady_clock::time_point lastFractionTime_;
+    std::chrono::microseconds dispatchTolerance_{ 0 };
+    std::chrono::microseconds lookahead_{ 0 };
     std::chrono::high_resolution_clock::time_point lastBeatTime_;
+
+    // last, so it is stopped before anything its resolve() uses goes away
+    choreo::ChoreoLoader loader_{ [this](const std::string& artist, const std::string& title, std::string& path) {
+        return resolve(artist, title, path);
+    } };
 };
\ No newline at end of file
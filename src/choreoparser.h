@@ -4,122 +4,182 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <filesystem>
 #include <fstream>
+#include <iterator>
+#include <system_error>
 #include <sstream>
 #include <algorithm>
 #include <cctype>
 #include <stdexcept>
 #include <cmath>
-
-#include "osc/OscOutboundPacketStream.h"
+#include <cstdint>
+#include <memory>
+#include <span>
 
 #include "beat_utils.h"
-
-/// If defined, wrappers BeginBundleImmediate/EndBundle are emitted
-#define CHOREO_BUNDLE_MESSAGES
+#include "hash.h"
+#include "logger.h"
+#include "oscpacket.h"
 
 namespace choreo {
 
-/// Simple OSC message container
-struct OSCMessage {
-    std::string address;
-    char        type;   // 'i','f','s', etc.
-    std::string data;   // textual representation
-};
-
 /// Instruction at a specific time (in beats)
 struct Instruction {
     double time;
     std::vector<OSCMessage> msgs;
 };
 
+/// Runtime form of a choreography: one entry per time slot, each slot's
+/// messages already encoded as a contiguous run of bundle elements.
+/// The arrays are views into `backing`, which is either a TimelineData built
+/// by the parser or a memory-mapped compiled file.
+struct Timeline {
+    std::span<const double>   times;    // sorted slot times in beats
+    std::span<const uint32_t> offsets;  // slot i is packets[offsets[i], offsets[i+1])
+    std::span<const uint32_t> counts;   // number of messages in slot i
+    std::span<const char>     packets;  // size-prefixed OSC messages
+    std::shared_ptr<const void> backing;
+
+    size_t size() const { return times.size(); }
+    const char* slotData(size_t i) const { return packets.data() + offsets[i]; }
+    size_t slotSize(size_t i) const { return offsets[i + 1] - offsets[i]; }
+};
+
+/// Heap storage of a parsed Timeline
+struct TimelineData {
+    std::vector<double>   times;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> counts;
+    std::vector<char>     packets;
+
+    static Timeline view(std::shared_ptr<const TimelineData> d) {
+        Timeline t{ d->times, d->offsets, d->counts, d->packets, nullptr };
+        t.backing = std::move(d);
+        return t;
+    }
+};
+
+/// What a startup scan learns about a file without parsing its body:
+/// the normalized `Match Song` / `Match Artist` patterns
+struct ChoreoHeader {
+    std::string path;
+    std::vector<std::string> titles, artists;
+};
+
 class ChoreoParser {
 public:
-    /// Load, optimize (merge & sort), and rewrite the file in-place
+    /// Load and optimize (merge & sort). The file itself is only read;
+    /// writeFormatted() rewrites it in canonical form on request.
     explicit ChoreoParser(const std::string& filename) {
         loadAndOptimize(filename);
         buildRuntimeInstructions();
-        writeOptimizedFile(filename);
-        nextIndex_ = 0;
     }
 
-    /// Case-insensitive alnum-only match against patterns
-    bool matches(const std::string& artist, const std::string& title) const {
-        return anyMatch(matchArtists_, artist)
-            && anyMatch(matchTitles_,  title);
+    /// Adopt an already compiled timeline (e.g. a mapped ChoreoCompiled file)
+    ChoreoParser(Timeline timeline, std::vector<std::string> titles, std::vector<std::string> artists)
+        : matchTitles_(std::move(titles))
+        , matchArtists_(std::move(artists))
+        , timeline_(std::move(timeline))
+    {}
+
+    const Timeline& timeline() const { return timeline_; }
+
+    /// Result of writeFormatted()
+    enum class FormatResult { Unchanged, Written, Failed };
+
+    /// Canonical text of the file as it would be written by writeFormatted()
+    std::string formatted() const {
+        std::ostringstream out;
+        writeCanonical(out);
+        return out.str();
     }
 
-    /// Update by beat position. deltaBeat in beats
-    /// Adds messages to `p`. Returns true if any were added.
-    bool update(int beat, double frac,
-         double deltaBeat,
-         osc::OutboundPacketStream& p)
-    {
-        // std::cout << ", deltaBeat: " << deltaBeat << "\n"; 
-        // deltabeat usually around 0.4
-        double cur = beat + frac;
-        double w0  = cur; // - deltaBeat;
-        double w1  = cur + deltaBeat;
-
-#ifdef CHOREO_BUNDLE_MESSAGES
-        p << osc::BeginBundleImmediate;
-#endif
-        bool sent = false;
-
-        // Binary search for first instruction >= w0 (search entire list)
-        Instruction probe_w0{w0, {}};
-        auto it_start = std::lower_bound(
-            instructions_.begin(),
-            instructions_.end(), 
-            probe_w0,
-            [](const auto& a, const auto& b) { return a.time < b.time; }
-        );
-
-        // Binary search for first instruction > w1 (search entire list)
-        Instruction probe_w1{w1, {}};
-        auto it_end = std::upper_bound(
-            instructions_.begin(),
-            instructions_.end(),
-            probe_w1,
-            [](const auto& a, const auto& b) { return a.time < b.time; }
-        );
-
-        // Send all instructions in the range [w0, w1]
-        for (auto it = it_start; it != it_end; ++it) {
-            for (const auto& m : it->msgs) {
-                p << osc::BeginMessage(m.address.c_str());
-                pushArg(p, m);
-                p << osc::EndMessage;
-                sent = true;
+    /// Rewrite `fn` in canonical form, but only if its bytes differ (compared
+    /// by content hash). Written to a temporary file and renamed over `fn`,
+    /// so the file is never seen half written.
+    FormatResult writeFormatted(const std::string& fn) const {
+        // a parser adopted from a compiled timeline has no source text
+        if (elements_.empty()) return FormatResult::Failed;
+        std::string canonical = formatted();
+        {
+            std::ifstream in(fn, std::ios::binary);
+            std::string current((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            if (in && current.size() == canonical.size()
+                && fnv1a(current.data(), current.size()) == fnv1a(canonical.data(), canonical.size()))
+                return FormatResult::Unchanged;
+        }
+        std::string tmp = fn + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if (!out || !out.write(canonical.data(), static_cast<std::streamsize>(canonical.size()))) {
+                LOG_WARN("Cannot open %s for writing", tmp.c_str());
+                return FormatResult::Failed;
             }
         }
+        std::error_code ec;
+        std::filesystem::rename(tmp, fn, ec);
+        if (ec) {
+            LOG_WARN("Cannot replace %s: %s", fn.c_str(), ec.message().c_str());
+            std::filesystem::remove(tmp, ec);
+            return FormatResult::Failed;
+        }
+        return FormatResult::Written;
+    }
 
-#ifdef CHOREO_BUNDLE_MESSAGES
-        p << osc::EndBundle;
-#endif
-        return sent;
+    /// Read only the Match Song / Match Artist lines of `filename`
+    static ChoreoHeader readHeader(const std::string& filename) {
+        std::ifstream in(filename);
+        if (!in) throw std::runtime_error("Cannot open " + filename);
+        ChoreoHeader h{filename, {}, {}};
+        int lineStage = 0;
+        std::string line;
+        while (lineStage < 2 && std::getline(in, line)) {
+            line.erase(std::remove(line.begin(), line.end(), '"'), line.end());
+            if (!line.empty() && line.front() == '#') continue;
+            if (std::all_of(line.begin(), line.end(), [](char c){ return std::isspace((unsigned char)c); }))
+                continue;
+            parseMatchLine(line, lineStage == 0 ? "Match Song" : "Match Artist",
+                           lineStage == 0 ? h.titles : h.artists);
+            ++lineStage;
+        }
+        if (lineStage < 2) throw std::runtime_error("Missing Match lines in " + filename);
+        return h;
     }
 
-    /// Wrapper by time in seconds (delta in sec, bpm)
-    bool updateWithTime(double currentTimeSec,
-                double deltaTimeSec,
-                double bpm,
-                osc::OutboundPacketStream& p)
-    {
-        double beatNumberNow = timeToBeatNumber(currentTimeSec, bpm);
-        int    beatInt    = static_cast<int>(std::floor(beatNumberNow));
-        double beatFrac   = beatNumberNow - beatInt;
-        double deltaBeats = deltaTimeSec * bpm / 60.0;
-        return update(beatInt, beatFrac, deltaBeats, p);
+    /// Approximate heap footprint of the parsed file, for cache budgeting
+    size_t memoryBytes() const {
+        size_t bytes = sizeof(*this)
+            + timeline_.times.size_bytes() + timeline_.offsets.size_bytes()
+            + timeline_.counts.size_bytes() + timeline_.packets.size_bytes()
+            + elements_.capacity() * sizeof(RawElement);
+        for (auto const& elem : elements_) {
+            bytes += elem.text.capacity() + elem.rows.capacity() * sizeof(ParsedLine);
+            for (auto const& pl : elem.rows) {
+                bytes += pl.msgs.capacity() * sizeof(OSCMessage);
+                for (auto const& m : pl.msgs) bytes += m.address.capacity() + m.data.capacity();
+            }
+        }
+        return bytes;
     }
 
-    /// Wrapper with int beat, double frac, and delta in seconds
-    bool updateWithMixed(int beat, double frac,
-            double deltaTimeSec, double bpm,
-            osc::OutboundPacketStream& p)
-    {
-        double deltaBeats = deltaTimeSec * bpm / 60.0;
-        return update(beat, frac, deltaBeats, p);
+    /// Case-insensitive alnum-only match against patterns
+    bool matches(const std::string& artist, const std::string& title) const {
+        return anyMatch(matchArtists_, normalize(artist))
+            && anyMatch(matchTitles_,  normalize(title));
+    }
+
+    /// `Match Song` / `Match Artist` patterns, already normalized
+    const std::vector<std::string>& matchTitles() const { return matchTitles_; }
+    const std::vector<std::string>& matchArtists() const { return matchArtists_; }
+
+    /// Lower-case, alphanumerics only: the form patterns and tracks are compared in
+    static std::string normalize(const std::string& s) {
+        std::string out;
+        out.reserve(s.size());
+        for (char c: s) if (std::isalnum((unsigned char)c))
+            out.push_back(std::tolower((unsigned char)c));
+        return out;
     }
 
 private:
@@ -136,8 +196,7 @@ private:
 
     std::vector<std::string> matchTitles_, matchArtists_;
     std::vector<RawElement> elements_;
-    std::vector<Instruction> instructions_;
-    size_t nextIndex_ = 0;
+    Timeline timeline_;
 
     /// Read TSV, group by comments, merge per-block, rebuild runtime list
     void loadAndOptimize(const std::string& fn) {
@@ -187,11 +246,9 @@ private:
 
                 if (cols.size() < 5 || (cols.size()-2)%3 != 0) {
                     // print out all the elements of cols
-                    std::cout << "Columns: ";
-                    for (const auto& col : cols) {
-                        std::cout << col << "|";
-                    }
-                    std::cout << '\n';
+                    std::string joined;
+                    for (const auto& col : cols) joined += col + "|";
+                    LOG_WARN("Columns: %s", joined.c_str());
 
                     throw std::runtime_error("Row in " + fn + "\nhas wrong number of populated cells");
                 }
@@ -209,6 +266,7 @@ private:
     }
 
     /// After loadAndOptimize, build global instruction list (merged & sorted)
+    /// and encode every slot into its wire form
     void buildRuntimeInstructions() {
         std::map<double, Instruction> globalMap;
         for (auto const& elem : elements_) {
@@ -219,19 +277,23 @@ private:
                 inst.msgs.insert(inst.msgs.end(), pl.msgs.begin(), pl.msgs.end());
             }
         }
-        instructions_.clear();
-        instructions_.reserve(globalMap.size());
-        for (auto const& kv : globalMap)
-            instructions_.push_back(kv.second);
+        auto data = std::make_shared<TimelineData>();
+        data->times.reserve(globalMap.size());
+        data->offsets.reserve(globalMap.size() + 1);
+        data->counts.reserve(globalMap.size());
+        for (auto const& kv : globalMap) {
+            data->times.push_back(kv.first);
+            data->offsets.push_back(static_cast<uint32_t>(data->packets.size()));
+            data->counts.push_back(static_cast<uint32_t>(kv.second.msgs.size()));
+            for (auto const& m : kv.second.msgs)
+                encodeMessage(m, data->packets);
+        }
+        data->offsets.push_back(static_cast<uint32_t>(data->packets.size()));
+        timeline_ = TimelineData::view(std::move(data));
     }
 
-    /// Overwrite original file, sorting blocks and preserving comments
-    void writeOptimizedFile(const std::string& fn) const {
-        std::ofstream out(fn);
-        if (!out) {
-            std::cout << "Cannot open " << fn << " for writing\n";
-            return; // don't throw an error, its not terrible if we can't write optimized file
-        }
+    /// Canonical text of the file: blocks sorted and merged, comments kept
+    void writeCanonical(std::ostream& out) const {
         for (auto const& elem : elements_) {
             if (elem.isCommentOrHeader) {
                 out << elem.text << '\n';
@@ -273,7 +335,10 @@ private:
         auto cols = split(line, '\t');
         if (cols.empty() || cols[0] != expect)
             throw std::runtime_error("Expected '" + expect + "' line");
-        dest.assign(cols.begin()+1, cols.end());
+        // stored normalized so matching never re-normalizes the patterns
+        dest.clear();
+        for (auto it = cols.begin() + 1; it != cols.end(); ++it)
+            dest.push_back(normalize(*it));
     }
 
     static std::vector<std::string> split(const std::string& s, char delim) {
@@ -300,32 +365,11 @@ private:
         return base + std::stod(c1);
     }
 
-    static void pushArg(osc::OutboundPacketStream& p,
-                        OSCMessage const& m)
-    {
-        switch(m.type) {
-            case 'i': p << std::stoi(m.data); break;
-            case 'f': p << std::stof(m.data); break;
-            case 's': p << m.data.c_str();    break;
-            default: /* extend for 'd','b',... */ break;
-        }
-
-        std::cout << "OSC: " << m.address << " type: " << m.type << " data: " << m.data << '\n';
-    }
-
-    static std::string normalize(std::string s) {
-        std::string out;
-        for (char c: s) if (std::isalnum((unsigned char)c))
-            out.push_back(std::tolower((unsigned char)c));
-        return out;
-    }
-
     static bool anyMatch(const std::vector<std::string>& pats,
-                         const std::string& text)
+                         const std::string& norm)
     {
-        auto norm = normalize(text);
         for (auto const& p: pats)
-            if (normalize(p) == norm)
+            if (p == norm)
                 return true;
         return false;
     }
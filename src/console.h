@@ -0,0 +1,62 @@
+// console.h
+#pragma once
+
+// ------------------------
+// Non-blocking key input
+// ------------------------
+// _kbhit/_getch on Windows; on POSIX the terminal is switched to
+// non-canonical, no-echo mode for the lifetime of a console::RawMode.
+
+#ifdef _WIN32
+#include <conio.h>
+
+namespace console {
+
+struct RawMode {};
+
+inline bool keyPressed() { return _kbhit() != 0; }
+inline char getKey() { return static_cast<char>(_getch()); }
+
+} // namespace console
+
+#else
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace console {
+
+class RawMode {
+public:
+    RawMode() {
+        if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &saved_) != 0) return;
+        termios raw = saved_;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN]  = 0;
+        raw.c_cc[VTIME] = 0;
+        active_ = tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0;
+    }
+    ~RawMode() {
+        if (active_) tcsetattr(STDIN_FILENO, TCSANOW, &saved_);
+    }
+    RawMode(const RawMode&) = delete;
+    RawMode& operator=(const RawMode&) = delete;
+
+private:
+    termios saved_{};
+    bool active_ = false;
+};
+
+inline bool keyPressed() {
+    pollfd pfd{ STDIN_FILENO, POLLIN, 0 };
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
+inline char getKey() {
+    char c = 0;
+    return read(STDIN_FILENO, &c, 1) == 1 ? c : 0;
+}
+
+} // namespace console
+
+#endif
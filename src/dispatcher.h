@@ -0,0 +1,299 @@
+// dispatcher.h
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <time.h>
+#endif
+
+#include "logger.h"
+
+// ------------------------
+// Precise sleeping
+// ------------------------
+namespace timing {
+
+using Clock = std::chrono::steady_clock;
+
+/// Sleep until the absolute `deadline`, then busy-wait the last `spin` of it.
+/// Absolute deadlines don't accumulate error from the time spent between
+/// computing the deadline and going to sleep.
+inline void sleepUntil(Clock::time_point deadline,
+                       std::chrono::microseconds spin = std::chrono::microseconds(0))
+{
+    auto coarse = deadline - spin;
+    if (coarse > Clock::now()) {
+#ifdef _WIN32
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+        thread_local HANDLE timer = CreateWaitableTimerExW(
+            nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+        auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(coarse - Clock::now());
+        if (timer && remaining.count() > 0) {
+            LARGE_INTEGER due;
+            due.QuadPart = -static_cast<LONGLONG>(remaining.count() / 100); // relative, 100ns units
+            SetWaitableTimer(timer, &due, 0, nullptr, nullptr, FALSE);
+            WaitForSingleObject(timer, INFINITE);
+        } else {
+            std::this_thread::sleep_until(coarse);
+        }
+#else
+        // steady_clock is CLOCK_MONOTONIC on the platforms we build for
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(coarse.time_since_epoch()).count();
+        timespec ts;
+        ts.tv_sec  = static_cast<time_t>(ns / 1'000'000'000);
+        ts.tv_nsec = static_cast<long>(ns % 1'000'000'000);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+#endif
+    }
+    while (Clock::now() < deadline) {
+        // spin out the remainder
+    }
+}
+
+/// CPU time used by the whole process so far, in seconds
+inline double processCpuTime() {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) return 0.0;
+    auto ticks = [](const FILETIME& f) {
+        return (static_cast<uint64_t>(f.dwHighDateTime) << 32) | f.dwLowDateTime;
+    };
+    return (ticks(kernel) + ticks(user)) * 1e-7; // 100ns units
+#else
+    timespec ts;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0) return 0.0;
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+/// Running min/mean/max of how late something happened, in microseconds
+struct LatenessStats {
+    uint64_t count = 0;
+    double   sumUs = 0.0;
+    double   maxUs = 0.0;
+    double   minUs = 0.0;
+
+    void add(double us) {
+        if (count == 0 || us < minUs) minUs = us;
+        if (count == 0 || us > maxUs) maxUs = us;
+        sumUs += us;
+        ++count;
+    }
+    double meanUs() const { return count ? sumUs / count : 0.0; }
+};
+
+} // namespace timing
+
+// ------------------------
+// Deadline-driven dispatcher
+// ------------------------
+// Every event source (memory sampling, the next choreography slot, console
+// input) keeps at most one pending deadline in a small min-heap. The loop
+// sleeps until the earliest absolute deadline and hands it to the handler,
+// which re-arms whatever sources it needs.
+//
+// A dispatcher can also be woken from another thread: with a wake source
+// set, wake() cuts the current sleep short and the handler is called for
+// that source right away (once, however many wake() calls came in).
+
+class Dispatcher {
+public:
+    using Clock = timing::Clock;
+
+    enum class Source : uint8_t { Sample, Choreo, Console, Count };
+
+    explicit Dispatcher(std::chrono::microseconds spin = std::chrono::microseconds(0))
+        : spin_(spin)
+    {
+        heap_.reserve(static_cast<size_t>(Source::Count));
+    }
+
+    /// Arm `source` for `when`, replacing any deadline it already had
+    void schedule(Source source, Clock::time_point when) {
+        auto it = std::find_if(heap_.begin(), heap_.end(),
+                               [source](const Event& e) { return e.source == source; });
+        if (it != heap_.end()) {
+            it->when = when;
+            std::make_heap(heap_.begin(), heap_.end(), later);
+        } else {
+            heap_.push_back({ when, source });
+            std::push_heap(heap_.begin(), heap_.end(), later);
+        }
+    }
+
+    /// Disarm `source`
+    void cancel(Source source) {
+        auto it = std::remove_if(heap_.begin(), heap_.end(),
+                                 [source](const Event& e) { return e.source == source; });
+        if (it == heap_.end()) return;
+        heap_.erase(it, heap_.end());
+        std::make_heap(heap_.begin(), heap_.end(), later);
+    }
+
+    /// Let wake() interrupt the wait; the handler then gets `source`
+    void setWakeSource(Source source) {
+        wakeSource_ = source;
+        wakeable_ = true;
+    }
+
+    /// Call the handler for the wake source as soon as possible (any thread)
+    void wake() {
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex_);
+            woken_ = true;
+        }
+        wakeCv_.notify_one();
+    }
+
+    /// Run until the handler returns false, or nothing is armed and there is
+    /// no wake source. handler(Source, deadline) is called once per expired
+    /// deadline, and with the current time for a wake-up.
+    template<typename Handler>
+    void run(Handler&& handler) {
+        while (wakeable_ || !heap_.empty()) {
+            if (wakeable_) {
+                auto until = heap_.empty() ? Clock::now() + std::chrono::milliseconds(100)
+                                           : heap_.front().when - spin_;
+                if (waitForWake(until)) {
+                    if (!handler(wakeSource_, Clock::now())) break;
+                    continue;
+                }
+                if (heap_.empty()) continue;
+            }
+
+            std::pop_heap(heap_.begin(), heap_.end(), later);
+            Event ev = heap_.back();
+            heap_.pop_back();
+
+            timing::sleepUntil(ev.when, spin_);
+            auto woke = Clock::now();
+            stats_[static_cast<size_t>(ev.source)].add(
+                std::chrono::duration<double, std::micro>(woke - ev.when).count());
+
+            if (!handler(ev.source, ev.when)) break;
+        }
+    }
+
+    /// Wake-up lateness per source
+    const timing::LatenessStats& stats(Source source) const {
+        return stats_[static_cast<size_t>(source)];
+    }
+
+    void logStats() const {
+        static const char* names[] = { "sample", "choreo", "console" };
+        for (size_t i = 0; i < static_cast<size_t>(Source::Count); ++i) {
+            auto& s = stats_[i];
+            if (!s.count) continue;
+            LOG_INFO("Dispatch %-7s wake lateness: mean %.1f us, min %.1f us, max %.1f us over %llu events",
+                     names[i], s.meanUs(), s.minUs, s.maxUs, static_cast<unsigned long long>(s.count));
+        }
+    }
+
+private:
+    struct Event {
+        Clock::time_point when;
+        Source source;
+    };
+    static bool later(const Event& a, const Event& b) { return a.when > b.when; }
+
+    /// Wait for wake() until `until`; true (and consumed) if it came
+    bool waitForWake(Clock::time_point until) {
+        std::unique_lock<std::mutex> lock(wakeMutex_);
+        if (!wakeCv_.wait_until(lock, until, [this] { return woken_; })) return false;
+        woken_ = false;
+        return true;
+    }
+
+    std::chrono::microseconds spin_;
+    std::vector<Event> heap_;
+    bool wakeable_ = false;
+    Source wakeSource_ = Source::Sample;
+    // a condition variable rather than a semaphore: its timed wait sleeps in
+    // the kernel, where libstdc++'s semaphore polls with a growing backoff
+    std::mutex wakeMutex_;
+    std::condition_variable wakeCv_;
+    bool woken_ = false;
+    std::array<timing::LatenessStats, static_cast<size_t>(Source::Count)> stats_{};
+};
+
+// ------------------------
+// Jitter report
+// ------------------------
+// Fires the same set of randomly spaced events once through the old fixed
+// 120 Hz poll loop (event handled on the first tick at/after its time) and
+// once through deadline sleeping, and prints how far from the ideal time
+// each one was handled.
+
+inline void runJitterReport(std::chrono::seconds duration, std::chrono::microseconds spin) {
+    using Clock = timing::Clock;
+    using namespace std::chrono_literals;
+
+    // events every 20..250 ms, like a busy choreography
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<int> gapMs(20, 250);
+    std::vector<Clock::duration> offsets;
+    for (Clock::duration t = 100ms; t < duration; t += std::chrono::milliseconds(gapMs(rng)))
+        offsets.push_back(t);
+
+    auto report = [](const char* name, std::vector<double>& us) {
+        std::sort(us.begin(), us.end());
+        auto pct = [&](double p) { return us.empty() ? 0.0 : us[std::min(us.size() - 1, size_t(p * us.size()))]; };
+        double sum = 0.0;
+        for (double v : us) sum += v;
+        LOG_INFO("%-16s n=%zu  mean %8.1f us  p50 %8.1f us  p99 %8.1f us  max %8.1f us",
+                 name, us.size(), us.empty() ? 0.0 : sum / us.size(), pct(0.50), pct(0.99),
+                 us.empty() ? 0.0 : us.back());
+    };
+
+    if (offsets.empty()) return;
+    LOG_INFO("Jitter report: %zu events over %llds per mode", offsets.size(),
+             static_cast<long long>(duration.count()));
+
+    // 1) fixed 120 Hz poll loop
+    std::vector<double> legacy;
+    legacy.reserve(offsets.size());
+    {
+        auto start = Clock::now();
+        size_t next = 0;
+        while (next < offsets.size()) {
+            auto now = Clock::now();
+            while (next < offsets.size() && start + offsets[next] <= now) {
+                legacy.push_back(std::chrono::duration<double, std::micro>(now - (start + offsets[next])).count());
+                ++next;
+            }
+            std::this_thread::sleep_for(1000000us / 120);
+        }
+    }
+    report("120 Hz loop", legacy);
+
+    // 2) deadline dispatcher
+    std::vector<double> deadline;
+    deadline.reserve(offsets.size());
+    {
+        Dispatcher d(spin);
+        auto start = Clock::now();
+        size_t next = 0;
+        d.schedule(Dispatcher::Source::Choreo, start + offsets[next]);
+        d.run([&](Dispatcher::Source, Clock::time_point when) {
+            deadline.push_back(std::chrono::duration<double, std::micro>(Clock::now() - when).count());
+            if (++next < offsets.size()) d.schedule(Dispatcher::Source::Choreo, start + offsets[next]);
+            return true;
+        });
+    }
+    report("deadline", deadline);
+}
@@ -0,0 +1,15 @@
+// hash.h
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// 64-bit FNV-1a, continuing from `h`
+inline uint64_t fnv1a(const void* data, size_t size, uint64_t h = 14695981039346656037ull) {
+    auto p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
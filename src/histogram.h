@@ -0,0 +1,102 @@
+// histogram.h
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "logger.h"
+
+// ------------------------
+// Latency histogram
+// ------------------------
+// HDR-style log-linear buckets over nanoseconds: values below 32 ns get a
+// bucket each, every power of two above that is split into 32 sub-buckets,
+// so any recorded value is known to within ~3% up to ~18 minutes. Recording
+// is two relaxed atomic adds (and a CAS when a new maximum shows up), so it
+// is safe from any thread and cheap enough to leave on; a report taken while
+// others record sees a slightly torn but consistent-enough picture.
+//
+// Negative values (an event handled before its ideal time) are counted as
+// early and recorded as 0.
+
+class LatencyHistogram {
+public:
+    void record(std::chrono::nanoseconds value) {
+        int64_t ns = value.count();
+        if (ns < 0) {
+            early_.fetch_add(1, std::memory_order_relaxed);
+            ns = 0;
+        }
+        uint64_t v = static_cast<uint64_t>(ns);
+        counts_[index(v)].fetch_add(1, std::memory_order_relaxed);
+        total_.fetch_add(1, std::memory_order_relaxed);
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while (v > max && !max_.compare_exchange_weak(max, v, std::memory_order_relaxed)) {}
+    }
+
+    uint64_t count() const { return total_.load(std::memory_order_relaxed); }
+    uint64_t early() const { return early_.load(std::memory_order_relaxed); }
+    std::chrono::nanoseconds max() const {
+        return std::chrono::nanoseconds(max_.load(std::memory_order_relaxed));
+    }
+
+    /// Smallest value at or above `quantile` (0..1) of the recorded ones,
+    /// as the upper edge of its bucket
+    std::chrono::nanoseconds percentile(double quantile) const {
+        uint64_t total = count();
+        if (!total) return std::chrono::nanoseconds(0);
+        uint64_t rank = static_cast<uint64_t>(std::ceil(quantile * static_cast<double>(total)));
+        if (rank < 1) rank = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            seen += counts_[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                uint64_t upper = highest(i);
+                uint64_t max = max_.load(std::memory_order_relaxed);
+                return std::chrono::nanoseconds(upper < max ? upper : max);
+            }
+        }
+        return max();
+    }
+
+    /// One line with p50/p99/p99.9/max in microseconds
+    void log(const char* name) const {
+        uint64_t n = count();
+        if (!n) return;
+        auto us = [](std::chrono::nanoseconds d) { return d.count() / 1000.0; };
+        LOG_INFO("%-15s p50 %9.1f us  p99 %9.1f us  p99.9 %9.1f us  max %9.1f us  (n=%llu, %llu early)",
+                 name, us(percentile(0.50)), us(percentile(0.99)), us(percentile(0.999)), us(max()),
+                 static_cast<unsigned long long>(n), static_cast<unsigned long long>(early()));
+    }
+
+private:
+    static constexpr int      kSubBits = 5;
+    static constexpr uint64_t kSub     = uint64_t(1) << kSubBits;
+    static constexpr int      kMaxBits = 40;  // 2^40 ns, about 18 minutes
+    static constexpr size_t   kBuckets = (kMaxBits - kSubBits + 1) * kSub;
+
+    static size_t index(uint64_t v) {
+        if (v < kSub) return static_cast<size_t>(v);
+        int msb = 63 - std::countl_zero(v);
+        if (msb >= kMaxBits) return kBuckets - 1;
+        int shift = msb - kSubBits;
+        return static_cast<size_t>((shift + 1) * kSub + ((v >> shift) - kSub));
+    }
+
+    static uint64_t highest(size_t i) {
+        if (i < kSub) return i;
+        int shift = static_cast<int>(i / kSub) - 1;
+        uint64_t lower = (kSub + i % kSub) << shift;
+        return lower + (uint64_t(1) << shift) - 1;
+    }
+
+    std::array<std::atomic<uint64_t>, kBuckets> counts_{};
+    std::atomic<uint64_t> total_{ 0 };
+    std::atomic<uint64_t> early_{ 0 };
+    std::atomic<uint64_t> max_{ 0 };
+};
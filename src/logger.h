@@ -0,0 +1,199 @@
+// logger.h
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+// ------------------------
+// Asynchronous logger
+// ------------------------
+// Producers format into a fixed-size record and push it into a preallocated
+// bounded MPSC ring; a background thread drains the ring to the console and
+// an optional file. A full ring drops the record (and counts it) instead of
+// blocking, so the tick path never waits on terminal or disk I/O.
+
+namespace rklog {
+
+enum class Level : uint8_t { Debug, Info, Warn, Error, Off };
+
+inline const char* levelName(Level l) {
+    switch (l) {
+        case Level::Debug: return "debug";
+        case Level::Info:  return "info";
+        case Level::Warn:  return "warn";
+        case Level::Error: return "error";
+        default:           return "off";
+    }
+}
+
+/// Parse "debug", "info", "warn", "error" or "off". Returns false if unknown.
+inline bool parseLevel(const std::string& s, Level& out) {
+    for (auto l : { Level::Debug, Level::Info, Level::Warn, Level::Error, Level::Off }) {
+        if (s == levelName(l)) { out = l; return true; }
+    }
+    return false;
+}
+
+class Logger {
+public:
+    static constexpr size_t kCapacity = 4096; // records, power of two
+    static constexpr size_t kTextSize = 240;
+
+    static Logger& instance() {
+        static Logger logger;
+        return logger;
+    }
+
+    ~Logger() { stop(); }
+
+    /// Start the background drain thread (idempotent)
+    void start() {
+        bool expected = false;
+        if (!running_.compare_exchange_strong(expected, true)) return;
+        worker_ = std::thread([this] { run(); });
+    }
+
+    /// Stop the drain thread after writing everything still queued
+    void stop() {
+        if (running_.exchange(false) && worker_.joinable()) worker_.join();
+        drain();
+        uint64_t lost = dropped();
+        if (lost != 0 && lost != reportedDrops_) {
+            std::fprintf(stderr, "logger: %llu records dropped\n",
+                         static_cast<unsigned long long>(lost));
+            reportedDrops_ = lost;
+        }
+        if (file_) { std::fflush(file_); }
+    }
+
+    void setLevel(Level l) { level_.store(l, std::memory_order_relaxed); }
+    Level level() const { return level_.load(std::memory_order_relaxed); }
+    bool enabled(Level l) const { return l >= level() && l != Level::Off; }
+
+    /// Also append every record to `path`. Call before start().
+    bool setFile(const std::string& path) {
+        if (file_) std::fclose(file_);
+        file_ = std::fopen(path.c_str(), "a");
+        return file_ != nullptr;
+    }
+
+    /// printf-style; never blocks and never allocates
+    void log(Level l, const char* fmt, ...)
+#if defined(__GNUC__)
+        __attribute__((format(printf, 3, 4)))
+#endif
+    {
+        if (!enabled(l)) return;
+        va_list args;
+        va_start(args, fmt);
+        vlog(l, fmt, args);
+        va_end(args);
+    }
+
+    void vlog(Level l, const char* fmt, va_list args) {
+        // claim a cell (Vyukov bounded queue)
+        size_t pos = head_.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &cells_[pos & (kCapacity - 1)];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->level = l;
+        cell->time  = std::chrono::system_clock::now();
+        int n = std::vsnprintf(cell->text.data(), kTextSize, fmt, args);
+        cell->len = static_cast<uint16_t>(n < 0 ? 0 : (n >= int(kTextSize) ? kTextSize - 1 : n));
+        cell->seq.store(pos + 1, std::memory_order_release);
+    }
+
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq{ 0 };
+        Level level = Level::Info;
+        uint16_t len = 0;
+        std::chrono::system_clock::time_point time;
+        std::array<char, kTextSize> text;
+    };
+
+    Logger() {
+        for (size_t i = 0; i < kCapacity; ++i) cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    void run() {
+        using namespace std::chrono_literals;
+        while (running_.load(std::memory_order_acquire)) {
+            if (!drain()) std::this_thread::sleep_for(5ms);
+        }
+    }
+
+    /// Write out everything currently queued. Single consumer.
+    bool drain() {
+        bool any = false;
+        for (;;) {
+            Cell& cell = cells_[tail_ & (kCapacity - 1)];
+            if (cell.seq.load(std::memory_order_acquire) != tail_ + 1) break;
+            write(cell);
+            cell.seq.store(tail_ + kCapacity, std::memory_order_release);
+            ++tail_;
+            any = true;
+        }
+        if (any) {
+            std::fflush(stdout);
+            if (file_) std::fflush(file_);
+        }
+        return any;
+    }
+
+    void write(const Cell& cell) {
+        FILE* console = cell.level >= Level::Warn ? stderr : stdout;
+        if (cell.level >= Level::Warn)
+            std::fprintf(console, "%s: %.*s\n", levelName(cell.level), int(cell.len), cell.text.data());
+        else
+            std::fprintf(console, "%.*s\n", int(cell.len), cell.text.data());
+
+        if (file_) {
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                cell.time.time_since_epoch()).count();
+            std::fprintf(file_, "%lld.%03lld [%s] %.*s\n",
+                         static_cast<long long>(ms / 1000), static_cast<long long>(ms % 1000),
+                         levelName(cell.level), int(cell.len), cell.text.data());
+        }
+    }
+
+    std::array<Cell, kCapacity> cells_;
+    alignas(64) std::atomic<size_t> head_{ 0 };
+    alignas(64) size_t tail_ = 0;
+    std::atomic<uint64_t> dropped_{ 0 };
+    uint64_t reportedDrops_ = 0;
+    std::atomic<Level> level_{ Level::Info };
+    std::atomic<bool> running_{ false };
+    std::thread worker_;
+    FILE* file_ = nullptr;
+};
+
+} // namespace rklog
+
+#define LOG_DEBUG(...) ::rklog::Logger::instance().log(::rklog::Level::Debug, __VA_ARGS__)
+#define LOG_INFO(...)  ::rklog::Logger::instance().log(::rklog::Level::Info,  __VA_ARGS__)
+#define LOG_WARN(...)  ::rklog::Logger::instance().log(::rklog::Level::Warn,  __VA_ARGS__)
+#define LOG_ERROR(...) ::rklog::Logger::instance().log(::rklog::Level::Error, __VA_ARGS__)
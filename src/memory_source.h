@@ -0,0 +1,238 @@
+// memory_source.h
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <tlhelp32.h>
+#else
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <sys/types.h>
+#include <sys/uio.h>
+#endif
+
+// ------------------------
+// Memory source
+// ------------------------
+// Where the Rekordbox mirror reads from: the address of the main module and
+// raw reads at absolute addresses. Win32 uses ReadProcessMemory/Toolhelp32,
+// Linux uses /proc/<pid>/maps and process_vm_readv (e.g. rekordbox under
+// wine, or the fake_rekordbox stand-in for local profiling).
+
+/// One piece of a scatter-gather read
+struct ReadRange {
+    uintptr_t address;
+    void*     dst;
+    size_t    size;
+};
+
+class MemorySource {
+public:
+    virtual ~MemorySource() = default;
+
+    /// Base address of the main module
+    virtual uintptr_t moduleBase() const = 0;
+
+    /// Copy `size` bytes at `address` into `dst`. Returns false on failure.
+    virtual bool read(uintptr_t address, void* dst, size_t size) = 0;
+
+    /// Read several ranges, ideally in one call. Returns false if any failed.
+    virtual bool readv(const ReadRange* ranges, size_t count) {
+        bool ok = true;
+        for (size_t i = 0; i < count; ++i)
+            ok = read(ranges[i].address, ranges[i].dst, ranges[i].size) && ok;
+        return ok;
+    }
+
+    template<typename T>
+    bool readValue(uintptr_t address, T& out) { return read(address, &out, sizeof(T)); }
+
+    /// Number of cross-process read calls (syscalls) made so far
+    uint64_t readCalls() const { return readCalls_; }
+
+    /// Open the process running `exeName` and locate its main module.
+    /// Throws std::runtime_error if it isn't running or can't be opened.
+    static std::unique_ptr<MemorySource> open(const std::string& exeName);
+
+protected:
+    uint64_t readCalls_ = 0;
+};
+
+#ifdef _WIN32
+
+// ------------------------
+// Utilities to open process
+// ------------------------
+inline DWORD getProcessIdByName(const std::wstring& procName) {
+    PROCESSENTRY32W entry{ sizeof(entry) };
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (Process32FirstW(snapshot, &entry)) {
+        do {
+            if (procName == entry.szExeFile) {
+                CloseHandle(snapshot);
+                return entry.th32ProcessID;
+            }
+        } while (Process32NextW(snapshot, &entry));
+    }
+    CloseHandle(snapshot);
+    return 0;
+}
+
+inline SIZE_T getModuleBaseAddress(DWORD pid, const std::wstring& moduleName) {
+    MODULEENTRY32W me{ sizeof(me) };
+    HANDLE snap = CreateToolhelp32Snapshot(TH32CS_SNAPMODULE | TH32CS_SNAPMODULE32, pid);
+    if (Module32FirstW(snap, &me)) {
+        do {
+            if (moduleName == me.szModule) {
+                CloseHandle(snap);
+                return reinterpret_cast<SIZE_T>(me.modBaseAddr);
+            }
+        } while (Module32NextW(snap, &me));
+    }
+    CloseHandle(snap);
+    return 0;
+}
+
+class Win32MemorySource : public MemorySource {
+public:
+    explicit Win32MemorySource(const std::string& exeName) {
+        std::wstring name(exeName.begin(), exeName.end());
+        DWORD pid = getProcessIdByName(name);
+        if (!pid) throw std::runtime_error("Rekordbox not running");
+        hProc_ = OpenProcess(PROCESS_VM_READ | PROCESS_QUERY_INFORMATION, FALSE, pid);
+        if (!hProc_) throw std::runtime_error("Failed to OpenProcess");
+        base_ = getModuleBaseAddress(pid, name);
+        if (!base_) throw std::runtime_error("Module base not found");
+    }
+
+    ~Win32MemorySource() override { if (hProc_) CloseHandle(hProc_); }
+
+    uintptr_t moduleBase() const override { return base_; }
+
+    bool read(uintptr_t address, void* dst, size_t size) override {
+        ++readCalls_;
+        return ReadProcessMemory(hProc_, (LPCVOID)address, dst, size, nullptr) != 0;
+    }
+
+private:
+    HANDLE hProc_ = nullptr;
+    uintptr_t base_ = 0;
+};
+
+inline std::unique_ptr<MemorySource> MemorySource::open(const std::string& exeName) {
+    return std::make_unique<Win32MemorySource>(exeName);
+}
+
+#else
+
+// ------------------------
+// Utilities to find the process under /proc
+// ------------------------
+inline std::string baseName(const std::string& path) {
+    auto slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+/// pid whose comm or argv[0] basename is `procName`, 0 if none
+inline pid_t getProcessIdByName(const std::string& procName) {
+    DIR* proc = opendir("/proc");
+    if (!proc) return 0;
+    pid_t found = 0;
+    while (dirent* e = readdir(proc)) {
+        char* end;
+        long pid = std::strtol(e->d_name, &end, 10);
+        if (*end != '\0' || pid <= 0) continue;
+        std::string dir = std::string("/proc/") + e->d_name;
+
+        // comm is truncated to 15 characters
+        std::string comm;
+        std::getline(std::ifstream(dir + "/comm"), comm);
+        if (!comm.empty() && comm == procName.substr(0, 15)) { found = pid_t(pid); break; }
+
+        // wine shows up with the windows path in argv[0]
+        std::string argv0;
+        std::getline(std::ifstream(dir + "/cmdline"), argv0, '\0');
+        if (!argv0.empty() && baseName(argv0) == procName) { found = pid_t(pid); break; }
+    }
+    closedir(proc);
+    return found;
+}
+
+/// Start of the lowest mapping of a file named `moduleName`, 0 if none
+inline uintptr_t getModuleBaseAddress(pid_t pid, const std::string& moduleName) {
+    std::ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+    std::string line;
+    uintptr_t base = 0;
+    while (std::getline(maps, line)) {
+        // start-end perms offset dev inode pathname
+        std::istringstream iss(line);
+        std::string range, perms, offset, dev, inode, path;
+        iss >> range >> perms >> offset >> dev >> inode;
+        std::getline(iss >> std::ws, path);
+        if (path.empty() || baseName(path) != moduleName) continue;
+        uintptr_t start = std::stoull(range.substr(0, range.find('-')), nullptr, 16);
+        if (!base || start < base) base = start;
+    }
+    return base;
+}
+
+class LinuxMemorySource : public MemorySource {
+public:
+    explicit LinuxMemorySource(const std::string& exeName) {
+        pid_ = getProcessIdByName(exeName);
+        if (!pid_) throw std::runtime_error("Rekordbox not running");
+        base_ = getModuleBaseAddress(pid_, exeName);
+        if (!base_) throw std::runtime_error("Module base not found");
+        uint8_t probe;
+        if (!read(base_, &probe, 1)) {
+            throw std::runtime_error(std::string("Cannot read process memory: ") + std::strerror(errno)
+                + (errno == EPERM ? " (needs CAP_SYS_PTRACE or kernel.yama.ptrace_scope=0)" : ""));
+        }
+    }
+
+    uintptr_t moduleBase() const override { return base_; }
+
+    bool read(uintptr_t address, void* dst, size_t size) override {
+        ++readCalls_;
+        iovec local{ dst, size };
+        iovec remote{ reinterpret_cast<void*>(address), size };
+        return process_vm_readv(pid_, &local, 1, &remote, 1, 0) == static_cast<ssize_t>(size);
+    }
+
+    bool readv(const ReadRange* ranges, size_t count) override {
+        if (count == 0) return true;
+        if (count > kMaxIov) return MemorySource::readv(ranges, count);
+        iovec local[kMaxIov]{}, remote[kMaxIov]{};
+        ssize_t total = 0;
+        for (size_t i = 0; i < count; ++i) {
+            local[i]  = { ranges[i].dst, ranges[i].size };
+            remote[i] = { reinterpret_cast<void*>(ranges[i].address), ranges[i].size };
+            total += static_cast<ssize_t>(ranges[i].size);
+        }
+        ++readCalls_;
+        if (process_vm_readv(pid_, local, count, remote, count, 0) == total) return true;
+        // partial read: one bad range (e.g. a string being reallocated)
+        // shouldn't take the others with it
+        return MemorySource::readv(ranges, count);
+    }
+
+private:
+    static constexpr size_t kMaxIov = 64;
+    pid_t pid_ = 0;
+    uintptr_t base_ = 0;
+};
+
+inline std::unique_ptr<MemorySource> MemorySource::open(const std::string& exeName) {
+    return std::make_unique<LinuxMemorySource>(exeName);
+}
+
+#endif
@@ -1,8 +1,14 @@
 # pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <span>
 #include <vector>
 #include <string>
 #include <sstream>
+#include <fstream>
+#include <stdexcept>
 #include <map>
 
 // ------------------------
@@ -11,21 +17,30 @@
 
 
 struct Pointer {
-    std::vector<SIZE_T> offsets;
-    SIZE_T final_offset;
+    static constexpr size_t kMaxDepth = 8;
+
+    // first `depth` entries are the hops, stored inline (no heap)
+    std::array<uintptr_t, kMaxDepth> offsets{};
+    uint8_t depth = 0;
+    uintptr_t final_offset = 0;
+
+    std::span<const uintptr_t> hops() const { return { offsets.data(), depth }; }
 
     static Pointer fromString(const std::string& s) {
         std::istringstream iss(s);
-        std::vector<SIZE_T> all;
+        std::vector<uintptr_t> all;
         std::string hex;
         while (iss >> hex) {
-            all.push_back(std::stoul(hex, nullptr, 16));
+            all.push_back(static_cast<uintptr_t>(std::stoull(hex, nullptr, 16)));
         }
+        if (all.empty() || all.size() - 1 > kMaxDepth)
+            throw std::runtime_error("Bad pointer chain: " + s);
         // last element is final_offset
         Pointer p;
         p.final_offset = all.back();
         all.pop_back();
-        p.offsets = std::move(all);
+        std::copy(all.begin(), all.end(), p.offsets.begin());
+        p.depth = static_cast<uint8_t>(all.size());
         return p;
     }
 };
@@ -34,6 +49,16 @@ struct RekordboxOffsets {
     std::string version;
     Pointer deck1bar, deck1beat, deck2bar, deck2beat, master_bpm, masterdeck_index, deck1artist, deck1title, deck2artist, deck2title;
 
+    /// Fields in file order
+    enum Field { Deck1Bar, Deck1Beat, Deck2Bar, Deck2Beat, MasterBpm, MasterdeckIndex,
+                 Deck1Artist, Deck1Title, Deck2Artist, Deck2Title, FieldCount };
+
+    const Pointer& field(Field f) const {
+        const Pointer* all[FieldCount] = { &deck1bar, &deck1beat, &deck2bar, &deck2beat, &master_bpm,
+                                           &masterdeck_index, &deck1artist, &deck1title, &deck2artist, &deck2title };
+        return *all[f];
+    }
+
     static std::map<std::string, RekordboxOffsets> loadFromFile(const std::string& path) {
         std::ifstream in(path);
         if (!in) throw std::runtime_error("Could not open offsets file");
@@ -0,0 +1,246 @@
+// oscpacket.h
+#pragma once
+
+#include <cstddef>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "osc/OscOutboundPacketStream.h"
+#include "osc/OscReceivedElements.h"
+
+/// If defined, wrappers BeginBundleImmediate/EndBundle are emitted
+#define CHOREO_BUNDLE_MESSAGES
+
+namespace choreo {
+
+/// Simple OSC message container
+struct OSCMessage {
+    std::string address;
+    char        type;   // 'i','f','s', etc.
+    std::string data;   // textual representation
+};
+
+/// Encode `m` once into its wire form and append it to `out` as a bundle
+/// element: a 4-byte big-endian size followed by the padded OSC message.
+/// Throws if the textual value does not parse as the declared type.
+inline void encodeMessage(const OSCMessage& m, std::vector<char>& out) {
+    // let oscpack do the padding/type tags by wrapping the message in a
+    // throwaway bundle, then keep only the element (size + message)
+    static constexpr std::size_t kBundleHeader = 16; // "#bundle\0" + timetag
+    std::vector<char> buf(kBundleHeader + 4 + m.address.size() + m.data.size() + 32);
+    osc::OutboundPacketStream p{ buf.data(), buf.size() };
+    try {
+        p << osc::BeginBundleImmediate << osc::BeginMessage(m.address.c_str());
+        switch (m.type) {
+            case 'i': p << static_cast<osc::int32>(std::stoi(m.data)); break;
+            case 'f': p << std::stof(m.data); break;
+            case 's': p << m.data.c_str();    break;
+            default: /* extend for 'd','b',... */ break;
+        }
+        p << osc::EndMessage << osc::EndBundle;
+    } catch (const std::exception&) {
+        throw std::runtime_error("Bad OSC value '" + m.data + "' of type '"
+                                 + std::string(1, m.type) + "' for " + m.address);
+    }
+    out.insert(out.end(), p.Data() + kBundleHeader, p.Data() + p.Size());
+}
+
+/// Size of the element starting at `element` (excluding its size prefix)
+inline std::size_t elementSize(const char* element) {
+    auto b = reinterpret_cast<const unsigned char*>(element);
+    return (std::size_t(b[0]) << 24) | (std::size_t(b[1]) << 16)
+         | (std::size_t(b[2]) << 8)  |  std::size_t(b[3]);
+}
+
+/// OSC time tag (NTP format: 32.32 fixed-point seconds since 1900) for `t`
+inline std::uint64_t toTimeTag(std::chrono::system_clock::time_point t) {
+    static constexpr std::uint64_t kNtpUnixOffset = 2208988800ull; // 1900 -> 1970
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+    std::uint64_t secs = static_cast<std::uint64_t>(ns / 1'000'000'000) + kNtpUnixOffset;
+    std::uint64_t frac = (static_cast<std::uint64_t>(ns % 1'000'000'000) << 32) / 1'000'000'000;
+    return (secs << 32) | frac;
+}
+
+/// Maps beat positions to OSC time tags from an anchor: the time tag at
+/// which `anchorBeat` was observed and the current beat length
+struct TimeTagClock {
+    double        anchorBeat     = 0.0;
+    double        secondsPerBeat = 0.5;
+    std::uint64_t anchorTag      = 1;
+
+    std::uint64_t at(double beat) const {
+        double dt = (beat - anchorBeat) * secondsPerBeat;
+        return anchorTag + static_cast<std::uint64_t>(static_cast<std::int64_t>(dt * 4294967296.0));
+    }
+
+    /// |a - b| in seconds
+    static double distance(std::uint64_t a, std::uint64_t b) {
+        return static_cast<double>(a > b ? a - b : b - a) / 4294967296.0;
+    }
+};
+
+/// Render the message in a size-prefixed element as "address arg..." into
+/// `out` for logging. Never allocates; output is truncated to `cap`.
+inline void describeElement(const char* element, char* out, std::size_t cap) {
+    std::size_t n = 0;
+    auto put = [&](int w) { if (w > 0) n = std::min(cap - 1, n + std::size_t(w)); };
+    try {
+        osc::ReceivedMessage m(osc::ReceivedPacket(element + 4, elementSize(element)));
+        put(std::snprintf(out, cap, "%s", m.AddressPattern()));
+        for (auto a = m.ArgumentsBegin(); a != m.ArgumentsEnd(); ++a) {
+            switch (a->TypeTag()) {
+                case 'i': put(std::snprintf(out + n, cap - n, " %d i", int(a->AsInt32Unchecked()))); break;
+                case 'f': put(std::snprintf(out + n, cap - n, " %g f", a->AsFloatUnchecked())); break;
+                case 's': put(std::snprintf(out + n, cap - n, " %s s", a->AsStringUnchecked())); break;
+                default:  put(std::snprintf(out + n, cap - n, " ? %c", a->TypeTag())); break;
+            }
+        }
+    } catch (const osc::Exception&) {
+        std::snprintf(out, cap, "<malformed message>");
+    }
+}
+
+/// Fixed-capacity outbound datagram assembled from pre-encoded bundle
+/// elements. Elements are memcpy'd in; when the next one would not fit the
+/// current datagram is handed to the sink and a fresh bundle is started.
+class PacketBuilder {
+public:
+    using Sink = std::function<void(const char* data, std::size_t size)>;
+
+    /// Keep datagrams under a typical Ethernet MTU to avoid IP fragmentation
+    static constexpr std::size_t kCapacity = 1472;
+
+    explicit PacketBuilder(Sink sink = {}) : sink_(std::move(sink)) { reset(); }
+
+    void setSink(Sink sink) { sink_ = std::move(sink); }
+
+    /// Append a run of `count` size-prefixed elements (e.g. a whole time slot)
+    void append(const char* elements, std::size_t size, std::size_t count) {
+#ifdef CHOREO_BUNDLE_MESSAGES
+        if (size_ + size <= kCapacity) {
+            std::memcpy(buf_ + size_, elements, size);
+            size_ += size;
+            count_ += count;
+            return;
+        }
+#endif
+        // does not fit in one go: split on element boundaries
+        const char* end = elements + size;
+        while (elements < end) {
+            std::size_t n = 4 + elementSize(elements);
+            appendElement(elements, n);
+            elements += n;
+        }
+    }
+
+    /// Append a run of `count` size-prefixed elements wrapped in a nested
+    /// bundle stamped with `timeTag`, so receivers that honour time tags
+    /// execute them at that time rather than on arrival
+    void appendTimed(std::uint64_t timeTag, const char* elements, std::size_t size, std::size_t count) {
+#ifdef CHOREO_BUNDLE_MESSAGES
+        static constexpr std::size_t kNested = 4 + 16; // size prefix + bundle header
+        if (size_ + kNested + size > kCapacity) flush();
+        if (size_ + kNested + size <= kCapacity) {
+            writeNestedHeader(timeTag, size);
+            std::memcpy(buf_ + size_, elements, size);
+            size_ += size;
+            count_ += count;
+            return;
+        }
+        // slot larger than a datagram: one nested bundle per message
+        const char* end = elements + size;
+        while (elements < end) {
+            std::size_t n = 4 + elementSize(elements);
+            if (size_ + kNested + n > kCapacity) flush();
+            if (size_ + kNested + n > kCapacity)
+                throw std::runtime_error("OSC message larger than datagram capacity");
+            writeNestedHeader(timeTag, n);
+            std::memcpy(buf_ + size_, elements, n);
+            size_ += n;
+            ++count_;
+            elements += n;
+        }
+#else
+        // no bundles, no time tags: fall back to sending immediately
+        (void)timeTag;
+        append(elements, size, count);
+#endif
+    }
+
+    /// Send whatever has been collected. Returns true if a datagram went out.
+    bool flush() {
+        if (count_ == 0) return false;
+        if (sink_) sink_(buf_, size_);
+        ++sent_;
+        reset();
+        return true;
+    }
+
+    /// Number of messages added since the last flush
+    std::size_t pending() const { return count_; }
+    /// Number of datagrams handed to the sink so far
+    std::uint64_t datagramsSent() const { return sent_; }
+
+    const char* data() const { return buf_; }
+    std::size_t size() const { return size_; }
+
+private:
+    void appendElement(const char* element, std::size_t n) {
+#ifdef CHOREO_BUNDLE_MESSAGES
+        if (size_ + n > kCapacity) flush();
+        if (size_ + n > kCapacity)
+            throw std::runtime_error("OSC message larger than datagram capacity");
+        std::memcpy(buf_ + size_, element, n);
+        size_ += n;
+        ++count_;
+#else
+        // one message per datagram, without the bundle size prefix
+        if (n - 4 > kCapacity)
+            throw std::runtime_error("OSC message larger than datagram capacity");
+        std::memcpy(buf_, element + 4, n - 4);
+        size_ = n - 4;
+        count_ = 1;
+        flush();
+#endif
+    }
+
+#ifdef CHOREO_BUNDLE_MESSAGES
+    void writeNestedHeader(std::uint64_t timeTag, std::size_t contentSize) {
+        std::size_t bundleSize = 16 + contentSize;
+        char* h = buf_ + size_;
+        h[0] = char(bundleSize >> 24); h[1] = char(bundleSize >> 16);
+        h[2] = char(bundleSize >> 8);  h[3] = char(bundleSize);
+        std::memcpy(h + 4, "#bundle", 8);
+        for (int i = 0; i < 8; ++i) h[12 + i] = char(timeTag >> (56 - 8 * i));
+        size_ += 20;
+    }
+#endif
+
+    void reset() {
+#ifdef CHOREO_BUNDLE_MESSAGES
+        // "#bundle\0" followed by the immediate time tag (0x0000000000000001)
+        static constexpr char kHeader[16] = { '#','b','u','n','d','l','e','\0',
+                                              0,0,0,0, 0,0,0,1 };
+        std::memcpy(buf_, kHeader, sizeof(kHeader));
+        size_ = sizeof(kHeader);
+#else
+        size_ = 0;
+#endif
+        count_ = 0;
+    }
+
+    Sink          sink_;
+    char          buf_[kCapacity];
+    std::size_t   size_  = 0;
+    std::size_t   count_ = 0;
+    std::uint64_t sent_  = 0;
+};
+
+} // namespace choreo
@@ -0,0 +1,127 @@
+// pipeline.h
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "adaptive_sampler.h"
+#include "dispatcher.h"
+#include "histogram.h"
+#include "logger.h"
+
+// ------------------------
+// Sampler / dispatcher / control pipeline
+// ------------------------
+// Three threads share the work that used to run in one loop:
+//   sampler    reads Rekordbox on the adaptive schedule and publishes each
+//              sample through a SeqLock, then wakes the dispatcher
+//   dispatcher follows the beat from the latest sample and owns choreography
+//              scheduling and sending
+//   control    reads the console and posts commands
+// A slow cross-process read therefore delays the next sample, never a
+// dispatch. The samples and the small channels below are lock-free; the only
+// lock is the dispatcher's wake-up, held just long enough to set a flag.
+
+namespace pipeline {
+
+/// Dispatcher -> sampler: upcoming beat edge and slot, for the sampling rate
+class OutlookChannel {
+public:
+    void publish(bool active, bool haveBeat, Dispatcher::Clock::time_point nextBeat,
+                 bool haveEvent, Dispatcher::Clock::time_point nextEvent) {
+        nextBeat_.store(haveBeat ? nextBeat.time_since_epoch().count() : kNone, std::memory_order_relaxed);
+        nextEvent_.store(haveEvent ? nextEvent.time_since_epoch().count() : kNone, std::memory_order_relaxed);
+        active_.store(active, std::memory_order_relaxed);
+    }
+
+    /// Fill in what the dispatcher published; lastBeatChange is the sampler's own
+    void read(AdaptiveSampler::Outlook& o) const {
+        using D = Dispatcher::Clock::duration;
+        auto beat = nextBeat_.load(std::memory_order_relaxed);
+        auto event = nextEvent_.load(std::memory_order_relaxed);
+        o.active = active_.load(std::memory_order_relaxed);
+        o.haveBeat = beat != kNone;
+        o.nextBeat = Dispatcher::Clock::time_point(D(beat));
+        o.haveEvent = event != kNone;
+        o.nextEvent = Dispatcher::Clock::time_point(D(event));
+    }
+
+private:
+    static constexpr int64_t kNone = INT64_MIN;
+    std::atomic<bool> active_{ false };
+    std::atomic<int64_t> nextBeat_{ kNone }, nextEvent_{ kNone };
+};
+
+/// Control -> dispatcher: offset nudges and quit
+class ControlChannel {
+public:
+    /// Nudge the beat offset by `ms` (control thread)
+    void nudge(int ms) {
+        int64_t now = Dispatcher::Clock::now().time_since_epoch().count();
+        int64_t none = 0;
+        since_.compare_exchange_strong(none, now, std::memory_order_relaxed);
+        offsetMs_.fetch_add(ms, std::memory_order_release);
+    }
+
+    /// Offset change posted since the last call; `posted` gets when the
+    /// oldest part of it was posted (dispatcher thread)
+    int takeOffset(Dispatcher::Clock::time_point& posted) {
+        int ms = offsetMs_.exchange(0, std::memory_order_acquire);
+        if (!ms) return 0;
+        int64_t since = since_.exchange(0, std::memory_order_relaxed);
+        posted = since ? Dispatcher::Clock::time_point(Dispatcher::Clock::duration(since))
+                       : Dispatcher::Clock::now();
+        return ms;
+    }
+
+    void quit() { quit_.store(true, std::memory_order_release); }
+    bool quitting() const { return quit_.load(std::memory_order_acquire); }
+
+private:
+    std::atomic<int> offsetMs_{ 0 };
+    std::atomic<int64_t> since_{ 0 };
+    std::atomic<bool> quit_{ false };
+};
+
+/// Per-stage latency, each owned by the thread of its stage and logged after
+/// the threads were joined
+struct StageStats {
+    timing::LatenessStats sampleRead;     // sampler: one Rekordbox read
+    timing::LatenessStats snapshotAge;    // sample taken -> picked up by the dispatcher
+    timing::LatenessStats dispatchWork;   // dispatcher: beat tracking, choreography, send
+    timing::LatenessStats commandDelay;   // key press posted -> applied by the dispatcher
+
+    void log() const {
+        auto line = [](const char* name, const timing::LatenessStats& s) {
+            if (!s.count) return;
+            LOG_INFO("Stage %-13s mean %.1f us, min %.1f us, max %.1f us over %llu",
+                     name, s.meanUs(), s.minUs, s.maxUs, static_cast<unsigned long long>(s.count));
+        };
+        line("sample read", sampleRead);
+        line("snapshot age", snapshotAge);
+        line("dispatch work", dispatchWork);
+        line("command delay", commandDelay);
+    }
+};
+
+/// Dispatcher tick distributions, recorded lock-free by the dispatcher and
+/// dumpable from any thread while it runs
+struct TickHistograms {
+    LatencyHistogram period;     // handler start -> next handler start
+    LatencyHistogram duration;   // handler start -> handler done
+
+    /// Dump together with the choreographer's slot lateness
+    void log(const LatencyHistogram& lateness) const {
+        LOG_INFO("Latency histograms:");
+        lateness.log("slot lateness");
+        period.log("tick period");
+        duration.log("tick duration");
+    }
+};
+
+inline double elapsedUs(Dispatcher::Clock::time_point since, Dispatcher::Clock::time_point until) {
+    return std::chrono::duration<double, std::micro>(until - since).count();
+}
+
+} // namespace pipeline
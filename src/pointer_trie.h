@@ -0,0 +1,102 @@
+// pointer_trie.h
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#include "offsets.h"
+#include "memory_source.h"
+
+// ------------------------
+// Pointer trie
+// ------------------------
+// The chains in offsets.txt share long prefixes (both decks' bar/beat hang
+// off the same object, so do each deck's artist/title). Compiling them into
+// a trie means every shared hop is dereferenced once per resolution pass,
+// and all hops of the same depth are fetched together in one readv.
+
+class PointerTrie {
+public:
+    static constexpr size_t kFields   = RekordboxOffsets::FieldCount;
+    static constexpr size_t kMaxNodes = kFields * Pointer::kMaxDepth;
+    static constexpr uint16_t kRoot   = 0xFFFF; // parent of depth-1 nodes: the module base
+
+    /// Result of a resolution pass for one field
+    struct Resolved {
+        uintptr_t address  = 0; // final field address
+        uintptr_t hopSlot  = 0; // where the last pointer was read from (0 if no hops)
+        uintptr_t hopValue = 0; // the pointer read there
+    };
+
+    static PointerTrie compile(const RekordboxOffsets& off) {
+        PointerTrie t;
+        for (size_t f = 0; f < kFields; ++f) {
+            const Pointer& p = off.field(static_cast<RekordboxOffsets::Field>(f));
+            uint16_t parent = kRoot;
+            for (size_t d = 0; d < p.depth; ++d)
+                parent = t.child(parent, p.offsets[d], static_cast<uint8_t>(d + 1));
+            t.leaf_[f]  = parent;
+            t.final_[f] = p.final_offset;
+        }
+        return t;
+    }
+
+    size_t nodeCount() const { return nodeCount_; }
+    uint8_t depth() const { return maxDepth_; }
+
+    /// Dereference every node, one batched read per depth level.
+    /// Nodes whose read failed resolve to 0 (and so do their children).
+    void resolve(MemorySource& mem, uintptr_t base, std::array<Resolved, kFields>& out) {
+        std::array<ReadRange, kMaxNodes> batch;
+        for (uint8_t d = 1; d <= maxDepth_; ++d) {
+            size_t n = 0;
+            for (size_t i = 0; i < nodeCount_; ++i) {
+                if (nodes_[i].depth != d) continue;
+                values_[i] = 0;
+                batch[n++] = { slot(i, base), &values_[i], sizeof(uintptr_t) };
+            }
+            if (n) mem.readv(batch.data(), n);
+        }
+        for (size_t f = 0; f < kFields; ++f) {
+            uint16_t leaf = leaf_[f];
+            if (leaf == kRoot) {
+                out[f] = { base + final_[f], 0, 0 };
+            } else {
+                out[f] = { values_[leaf] + final_[f], slot(leaf, base), values_[leaf] };
+            }
+        }
+    }
+
+private:
+    struct Node {
+        uint16_t  parent;
+        uint8_t   depth;
+        uintptr_t offset;
+    };
+
+    uint16_t child(uint16_t parent, uintptr_t offset, uint8_t depth) {
+        for (size_t i = 0; i < nodeCount_; ++i) {
+            if (nodes_[i].parent == parent && nodes_[i].offset == offset)
+                return static_cast<uint16_t>(i);
+        }
+        if (nodeCount_ == kMaxNodes) throw std::runtime_error("Pointer trie full");
+        nodes_[nodeCount_] = { parent, depth, offset };
+        if (depth > maxDepth_) maxDepth_ = depth;
+        return static_cast<uint16_t>(nodeCount_++);
+    }
+
+    /// Address the pointer of node `i` is read from
+    uintptr_t slot(size_t i, uintptr_t base) const {
+        const Node& n = nodes_[i];
+        return (n.parent == kRoot ? base : values_[n.parent]) + n.offset;
+    }
+
+    std::array<Node, kMaxNodes>      nodes_{};
+    std::array<uintptr_t, kMaxNodes> values_{};
+    std::array<uint16_t, kFields>    leaf_{};
+    std::array<uintptr_t, kFields>   final_{};
+    size_t  nodeCount_ = 0;
+    uint8_t maxDepth_  = 0;
+};
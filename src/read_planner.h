@@ -0,0 +1,92 @@
+// read_planner.h
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "memory_source.h"
+
+// ------------------------
+// Read planner
+// ------------------------
+// Collects every field to fetch per tick (remote address, size, where it
+// goes in a POD snapshot), sorts them and coalesces neighbours into as few
+// ranges as possible. execute() then fetches all ranges with one readv into
+// a scratch buffer and copies each field into the snapshot.
+
+class ReadPlan {
+public:
+    /// Fields closer than this are fetched as one range, gap included
+    static constexpr size_t kDefaultMaxGap = 64;
+
+    void clear() {
+        fields_.clear();
+        ranges_.clear();
+    }
+
+    /// Fetch `size` bytes at remote `address` into `snapshotOffset` of the snapshot
+    void add(uintptr_t address, size_t size, size_t snapshotOffset) {
+        fields_.push_back({ address, size, snapshotOffset, 0 });
+    }
+
+    /// Sort and coalesce the fields added so far
+    void build(size_t maxGap = kDefaultMaxGap) {
+        std::sort(fields_.begin(), fields_.end(),
+                  [](const Field& a, const Field& b) { return a.address < b.address; });
+        ranges_.clear();
+        size_t scratch = 0;
+        for (auto& f : fields_) {
+            if (!ranges_.empty()) {
+                Range& r = ranges_.back();
+                uintptr_t end = r.address + r.size;
+                if (f.address <= end + maxGap) {
+                    uintptr_t newEnd = std::max<uintptr_t>(end, f.address + f.size);
+                    scratch += newEnd - end;
+                    r.size = newEnd - r.address;
+                    f.scratchOffset = r.scratchOffset + (f.address - r.address);
+                    continue;
+                }
+            }
+            ranges_.push_back({ f.address, f.size, scratch });
+            f.scratchOffset = scratch;
+            scratch += f.size;
+        }
+        scratch_.assign(scratch, 0);
+        iov_.resize(ranges_.size());
+        for (size_t i = 0; i < ranges_.size(); ++i)
+            iov_[i] = { ranges_[i].address, scratch_.data() + ranges_[i].scratchOffset, ranges_[i].size };
+    }
+
+    /// Fetch everything and decode into `snapshot`. Returns false if a range failed.
+    bool execute(MemorySource& mem, void* snapshot) {
+        bool ok = mem.readv(iov_.data(), iov_.size());
+        auto out = static_cast<char*>(snapshot);
+        for (const auto& f : fields_)
+            std::memcpy(out + f.snapshotOffset, scratch_.data() + f.scratchOffset, f.size);
+        return ok;
+    }
+
+    size_t fieldCount() const { return fields_.size(); }
+    size_t rangeCount() const { return ranges_.size(); }
+
+private:
+    struct Field {
+        uintptr_t address;
+        size_t    size;
+        size_t    snapshotOffset;
+        size_t    scratchOffset;
+    };
+    struct Range {
+        uintptr_t address;
+        size_t    size;
+        size_t    scratchOffset;
+    };
+
+    std::vector<Field>     fields_;
+    std::vector<Range>     ranges_;
+    std::vector<ReadRange> iov_;
+    std::vector<char>      scratch_;
+};
@@ -0,0 +1,207 @@
+// realtime.h
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "alloc_counter.h"
+#include "logger.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+// ------------------------
+// Realtime operating mode
+// ------------------------
+// For shows: keep the tick path off the rest of the laptop. The process's
+// memory is locked and prefaulted (and malloc told to keep what it frees
+// mapped), and the sampling and dispatch threads run under SCHED_FIFO on
+// chosen CPUs. Each step that the privileges don't allow is reported and
+// skipped; the program runs on either way. Linux only; elsewhere every step
+// reports as unavailable.
+//
+// The steady-state tick path itself doesn't allocate (the buffers it uses
+// are sized when a track is loaded); SelfTest checks that, together with
+// page faults, on the hot threads over a measurement window.
+
+namespace realtime {
+
+struct Config {
+    bool enabled  = false;
+    int  priority = 80;     // SCHED_FIFO priority of the dispatcher; the sampler gets one less
+    int  samplerCpu    = -1;  // -1: leave affinity alone
+    int  dispatcherCpu = -1;
+};
+
+/// Lock all current and future memory and stop malloc from returning
+/// memory to the system, so the hot path never takes a page fault
+inline bool lockMemory() {
+#ifdef __linux__
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        LOG_WARN("Realtime: mlockall failed (%s), memory may page; raise RLIMIT_MEMLOCK or grant CAP_IPC_LOCK",
+                 std::strerror(errno));
+        return false;
+    }
+    rusage ru{};
+    getrusage(RUSAGE_SELF, &ru);
+    LOG_INFO("Realtime: memory locked, %ld MiB resident", ru.ru_maxrss / 1024);
+    return true;
+#else
+    LOG_WARN("Realtime: memory locking is only available on Linux");
+    return false;
+#endif
+}
+
+/// Touch the top of the calling thread's stack so its pages are mapped
+/// (and, after mlockall, locked) before the hot loop runs
+inline void prefaultStack() {
+    volatile char stack[256 * 1024];
+    for (size_t i = 0; i < sizeof(stack); i += 4096) stack[i] = 0;
+}
+
+/// Run the calling thread under SCHED_FIFO at `priority`, pinned to `cpu`
+/// if >= 0. Reports what it got; false if any part was refused.
+inline bool makeThreadRealtime(const char* name, int priority, int cpu) {
+    prefaultStack();
+#ifdef __linux__
+    bool ok = true;
+    std::string got;
+    sched_param sp{};
+    sp.sched_priority = priority;
+    if (int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp)) {
+        LOG_WARN("Realtime: %s thread stays SCHED_OTHER (SCHED_FIFO %d: %s); grant CAP_SYS_NICE or an rtprio limit",
+                 name, priority, std::strerror(err));
+        ok = false;
+        got = "SCHED_OTHER";
+    } else {
+        got = "SCHED_FIFO " + std::to_string(priority);
+    }
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+            LOG_WARN("Realtime: %s thread not pinned to CPU %d: %s", name, cpu, std::strerror(err));
+            ok = false;
+        } else {
+            got += " on CPU " + std::to_string(cpu);
+        }
+    }
+    LOG_INFO("Realtime: %s thread running %s", name, got.c_str());
+    return ok;
+#else
+    (void)priority;
+    (void)cpu;
+    LOG_WARN("Realtime: %s thread scheduling is only adjustable on Linux", name);
+    return false;
+#endif
+}
+
+/// Page faults and heap allocations of the calling thread so far
+struct ThreadCounters {
+    uint64_t minorFaults = 0;
+    uint64_t majorFaults = 0;
+    uint64_t allocations = 0;
+
+    static ThreadCounters now() {
+        ThreadCounters c;
+#ifdef __linux__
+        rusage ru{};
+        if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+            c.minorFaults = static_cast<uint64_t>(ru.ru_minflt);
+            c.majorFaults = static_cast<uint64_t>(ru.ru_majflt);
+        }
+#endif
+        c.allocations = alloc_counter::threadAllocations;
+        return c;
+    }
+};
+
+// ------------------------
+// Steady-state self-test
+// ------------------------
+// Each hot thread calls tick() from its loop. After the warm-up, the first
+// tick of a thread records its counters; the first tick past the end of the
+// window records them again. Once every thread has, the run can stop and
+// report() says whether any of them faulted or allocated in between.
+
+class SelfTest {
+public:
+    static constexpr int kThreads = 2;  // sampler, dispatcher
+
+    SelfTest(std::chrono::steady_clock::duration warmup, std::chrono::steady_clock::duration length) {
+        begin_ = std::chrono::steady_clock::now() + warmup;
+        end_ = begin_ + length;
+    }
+
+    /// Record thread `thread`'s counters at the window edges
+    void tick(int thread) {
+        Slot& s = slots_[thread];
+        if (s.done.load(std::memory_order_relaxed)) return;
+        auto now = std::chrono::steady_clock::now();
+        if (!s.begun) {
+            if (now < begin_) return;
+            s.before = ThreadCounters::now();
+            s.begun = true;
+        } else if (now >= end_) {
+            s.after = ThreadCounters::now();
+            s.done.store(true, std::memory_order_release);
+        }
+    }
+
+    /// Every thread got past the end of the window
+    bool finished() const {
+        for (const auto& s : slots_)
+            if (!s.done.load(std::memory_order_acquire)) return false;
+        return true;
+    }
+
+    /// Log the result; call after the threads were joined. True on a pass.
+    bool report() const {
+        static const char* names[kThreads] = { "sampler", "dispatcher" };
+        bool pass = finished();
+        double seconds = std::chrono::duration<double>(end_ - begin_).count();
+        for (int i = 0; i < kThreads; ++i) {
+            const Slot& s = slots_[i];
+            if (!s.done.load(std::memory_order_acquire)) {
+                LOG_ERROR("Self-test: %s thread never reached the end of the window", names[i]);
+                continue;
+            }
+            uint64_t minor = s.after.minorFaults - s.before.minorFaults;
+            uint64_t major = s.after.majorFaults - s.before.majorFaults;
+            uint64_t allocs = s.after.allocations - s.before.allocations;
+            bool ok = !minor && !major && !allocs;
+            pass = pass && ok;
+            LOG_INFO("Self-test: %s thread over %.0f s: %llu minor faults, %llu major faults, %llu allocations: %s",
+                     names[i], seconds, static_cast<unsigned long long>(minor),
+                     static_cast<unsigned long long>(major), static_cast<unsigned long long>(allocs),
+                     ok ? "ok" : "FAILED");
+        }
+        LOG_INFO("Self-test %s", pass ? "passed" : "failed");
+        return pass;
+    }
+
+private:
+    struct Slot {
+        bool begun = false;
+        ThreadCounters before, after;
+        std::atomic<bool> done{ false };
+    };
+
+    std::chrono::steady_clock::time_point begin_, end_;
+    std::array<Slot, kThreads> slots_;
+};
+
+} // namespace realtime
@@ -1,9 +1,13 @@
 ﻿// main.cpp
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
-#include <tlhelp32.h>
+#include <winsock2.h>
+#pragma comment(lib, "Ws2_32.lib")
+#endif
 #include <iostream>
+#include <iomanip>
 #include <fstream>
 #include <sstream>
 #include <vector>
@@ -11,11 +15,8 @@
 #include <string>
 #include <thread>
 #include <chrono>
-#include <conio.h>
-#include <winsock2.h>
 #include <filesystem>
-
-#pragma comment(lib, "Ws2_32.lib")
+#include <optional>
 
 // OSC pack (adjust include paths to your install)
 #include "osc/OscOutboundPacketStream.h"
@@ -26,6 +27,18 @@ using namespace osc;  // for OutboundPacketStream
 #include "offsets.h"
 #include "beatkeeper.h"
 #include "choreographer.h"
+#include "logger.h"
+#include "dispatcher.h"
+#include "adaptive_sampler.h"
+#include "pipeline.h"
+#include "seqlock.h"
+#include "realtime.h"
+#include "console.h"
+#include "alloc_counter.h"
+#include "trace.h"
+
+// count heap allocations so the steady-state tick can be checked for zero
+RKBX_DEFINE_ALLOCATION_COUNTER
 
 // Ableton Link C++ SDK
 //#include "Link.hpp"
@@ -53,6 +66,24 @@ int main(int argc, char* argv[]) {
     std::string src_addr = "0.0.0.0:0";
     std::string dst_addr = "127.0.0.1:6669";
     std::string choreo_folder = "";
+    std::string log_file = "";
+    std::chrono::microseconds spin{ 0 };
+    std::chrono::microseconds dispatch_tolerance{ 500 };
+    int jitter_report_seconds = 0;
+    std::chrono::milliseconds lookahead{ 0 };
+    std::chrono::milliseconds track_poll{ 250 };
+    size_t choreo_cache_mb = 64;
+    std::string compiled_dir;
+    bool compiled_enabled = true;
+    bool format_only = false;
+    bool concurrent_decks = false;
+    std::string deck_dst_addr[2];
+    double sample_min_hz = 20.0, sample_max_hz = 500.0;
+    realtime::Config rt;
+    int selftest_seconds = 0;
+    std::string record_trace, replay_trace;
+    bool replay_virtual = false;
+    rklog::Level log_level = rklog::Level::Info;
 
     // 2) simple flag parse
     for (int i = 1; i < argc; ++i) {
@@ -78,6 +109,73 @@ int main(int argc, char* argv[]) {
         else if (a == "-c" && i + 1 < argc) {
             choreo_folder = argv[++i];
         }
+        else if (a == "-l" && i + 1 < argc) {
+            if (!rklog::parseLevel(argv[++i], log_level)) {
+                std::cerr << "Unknown log level: " << argv[i] << "\n";
+                return 1;
+            }
+        }
+        else if (a == "-f" && i + 1 < argc) {
+            log_file = argv[++i];
+        }
+        else if (a == "-w" && i + 1 < argc) {
+            spin = std::chrono::microseconds(std::stoi(argv[++i]));
+        }
+        else if (a == "-a" && i + 1 < argc) {
+            lookahead = std::chrono::milliseconds(std::stoi(argv[++i]));
+        }
+        else if (a == "-r" && i + 1 < argc) {
+            track_poll = std::chrono::milliseconds(std::stoi(argv[++i]));
+        }
+        else if (a == "-p" && i + 1 < argc) {
+            std::string range = argv[++i];
+            auto sep = range.find(':');
+            sample_min_hz = std::stod(range.substr(0, sep));
+            sample_max_hz = sep == std::string::npos ? sample_min_hz : std::stod(range.substr(sep + 1));
+        }
+        else if (a == "-R") {
+            rt.enabled = true;
+        }
+        else if (a == "-P" && i + 1 < argc) {
+            rt.priority = std::stoi(argv[++i]);
+        }
+        else if (a == "-A" && i + 1 < argc) {
+            std::string cpus = argv[++i];
+            auto sep = cpus.find(',');
+            rt.samplerCpu = std::stoi(cpus.substr(0, sep));
+            rt.dispatcherCpu = sep == std::string::npos ? rt.samplerCpu : std::stoi(cpus.substr(sep + 1));
+        }
+        else if (a == "-T" && i + 1 < argc) {
+            selftest_seconds = std::stoi(argv[++i]);
+        }
+        else if (a == "-W" && i + 1 < argc) {
+            record_trace = argv[++i];
+        }
+        else if (a == "-Y" && i + 1 < argc) {
+            replay_trace = argv[++i];
+        }
+        else if (a == "-V") {
+            replay_virtual = true;
+        }
+        else if (a == "-m" && i + 1 < argc) {
+            choreo_cache_mb = std::stoul(argv[++i]);
+        }
+        else if (a == "-k" && i + 1 < argc) {
+            compiled_dir = argv[++i];
+            compiled_enabled = compiled_dir != "none";
+        }
+        else if (a == "-d") {
+            concurrent_decks = true;
+        }
+        else if ((a == "-1" || a == "-2") && i + 1 < argc) {
+            deck_dst_addr[a[1] - '1'] = argv[++i];
+        }
+        else if (a == "-F") {
+            format_only = true;
+        }
+        else if (a == "-j" && i + 1 < argc) {
+            jitter_report_seconds = std::stoi(argv[++i]);
+        }
         else if (a == "-h") {
             std::cout << R"(
 Usage:
@@ -88,7 +186,28 @@ Usage:
                 "-s <src>  source UDP (host:port)\n"
                 "-t <dst>  target UDP (host:port)\n"
                 "-c <dir>  choreography folder\n"
-                "Press i/k to adjust offset by ±1ms, c to quit.\n";
+                "-l <lvl>  log level: debug, info, warn, error, off (default: info)\n"
+                "-f <file> also append log to file\n"
+                "-w <us>   busy-wait the last <us> before each dispatch deadline (default: 0)\n"
+                "-a <ms>   send slots <ms> early in time-tagged bundles (default: 0, immediate)\n"
+                "-r <ms>   read the loaded tracks' artist/title every <ms> (default: 250)\n"
+                "-p <min:max> memory sampling rate range in Hz, fast around beat edges and slots (default: 20:500)\n"
+                "-R        realtime mode: lock memory, SCHED_FIFO sampler and dispatcher threads (Linux)\n"
+                "-P <prio> SCHED_FIFO priority of the dispatcher thread in realtime mode (default: 80)\n"
+                "-A <cpu>[,<cpu>] pin the sampler[, dispatcher] thread to a CPU in realtime mode\n"
+                "-T <sec>  self-test: after a warm-up, check the hot threads take no page faults or\n"
+                "          allocations for <sec> seconds, then exit (non-zero on failure)\n"
+                "-W <file> record every Rekordbox sample to a binary trace\n"
+                "-Y <file> replay a recorded trace instead of reading Rekordbox, then exit\n"
+                "-V        replay as fast as possible in virtual time instead of in real time\n"
+                "-m <MB>   memory budget for parsed choreographies (default: 64)\n"
+                "-k <dir>  compiled choreography cache (default: per-user cache dir, none to disable)\n"
+                "-d        play the choreographies of both decks at once, not just the master's\n"
+                "-1 <dst>  send deck 1's choreography to its own target UDP (host:port)\n"
+                "-2 <dst>  send deck 2's choreography to its own target UDP (host:port)\n"
+                "-F        rewrite changed choreography files in canonical (sorted, merged) form and exit\n"
+                "-j <sec>  compare dispatch jitter of the old 120 Hz loop and the deadline dispatcher, then exit\n"
+                "Press i/k to adjust offset by ±1ms, h to dump latency histograms, c to quit.\n";
             return 0;
         }
     }
@@ -98,35 +217,76 @@ Usage:
         std::cerr << "Unsupported version: " << target_version << "\n";
         return 1;
     }
-    std::cout << "Targeting Rekordbox version " << target_version << "\n";
+    // console output from here on goes through the async logger
+    auto& logger = rklog::Logger::instance();
+    logger.setLevel(log_level);
+    if (!log_file.empty() && !logger.setFile(log_file)) {
+        std::cerr << "Cannot open log file " << log_file << "\n";
+        return 1;
+    }
+    logger.start();
+
+    if (jitter_report_seconds > 0) {
+        runJitterReport(std::chrono::seconds(jitter_report_seconds), spin);
+        logger.stop();
+        return 0;
+    }
+
+    LOG_INFO("Targeting Rekordbox version %s", target_version.c_str());
 
     // 2.5) Determine choreography folder
     if (choreo_folder.empty()) {
         // Try default "choreo" folder next to executable
         choreo_folder = "./choreo";
         if (!std::filesystem::exists(choreo_folder) || !std::filesystem::is_directory(choreo_folder)) {
-            std::cerr << "Error: No choreography folder specified and default './choreo' not found.\n";
-            std::cerr << "Use -c <folder> to specify choreography folder.\n";
+            LOG_ERROR("No choreography folder specified and default './choreo' not found.");
+            LOG_ERROR("Use -c <folder> to specify choreography folder.");
             return 1;
         }
     } else {
         // Check if specified folder exists
         if (!std::filesystem::exists(choreo_folder) || !std::filesystem::is_directory(choreo_folder)) {
-            std::cerr << "Error: Choreography folder '" << choreo_folder << "' does not exist or is not a directory.\n";
+            LOG_ERROR("Choreography folder '%s' does not exist or is not a directory.", choreo_folder.c_str());
             return 1;
         }
     }
 
-    std::cout << "Using choreography folder: " << choreo_folder << "\n";
+    LOG_INFO("Using choreography folder: %s", choreo_folder.c_str());
+
+    if (format_only) {
+        size_t failed = Choreographer::formatChoreoFiles(choreo_folder);
+        logger.stop();
+        return failed ? 1 : 0;
+    }
 
     // 3) setup Choreographer
     Choreographer choreo(choreo_folder);
+    choreo.setCacheBudget(choreo_cache_mb << 20);
+    if (compiled_enabled) {
+        std::filesystem::path dir = compiled_dir.empty() ? choreo::ChoreoCompiled::defaultCacheDir()
+                                                         : std::filesystem::path(compiled_dir);
+        if (choreo::ChoreoCompiled::prepareCacheDir(dir))
+            choreo.setCompiledDir(dir.string());
+        else
+            LOG_WARN("Compiled choreographies disabled");
+    }
     if (osc_enabled) {
         if (!choreo.setupOsc(dst_addr)) {
-            std::cerr << "Failed to setup OSC socket for " << dst_addr << "\n";
+            LOG_ERROR("Failed to setup OSC socket for %s", dst_addr.c_str());
             return 1;
         }
+        for (int deck = 0; deck < 2; ++deck) {
+            if (!deck_dst_addr[deck].empty() && !choreo.setupDeckOsc(deck, deck_dst_addr[deck])) {
+                LOG_ERROR("Failed to setup OSC socket for %s", deck_dst_addr[deck].c_str());
+                return 1;
+            }
+        }
     }
+    choreo.setConcurrentDecks(concurrent_decks);
+    choreo.setDispatchTolerance(dispatch_tolerance);
+    choreo.setLookahead(lookahead);
+
+    choreo.watchChoreoFiles(choreo_folder);
 
     // 4) Ableton Link
     //Link link(120.0);
@@ -135,45 +295,138 @@ Usage:
     //link.captureAppSessionState(state);
     //link.enable(true);
 
-    // 5) BeatKeeper
+    // 5) BeatKeeper, fed from a recorded trace instead of Rekordbox if asked
+    if (!replay_trace.empty()) {
+        trace::TraceReader reader;
+        if (!reader.open(replay_trace)) {
+            logger.stop();
+            return 1;
+        }
+        BeatKeeper keeper(&choreo);
+        trace::Replay replay(reader, keeper, choreo);
+        replay.setTolerance(dispatch_tolerance);
+        LOG_INFO("Replaying %s in %s time", replay_trace.c_str(), replay_virtual ? "virtual" : "real");
+        replay.run(replay_virtual);
+        replay.logStats();
+        keeper.logStats();
+        choreo.logStats();
+        choreo.lateness().log("slot lateness");
+        logger.stop();
+        return 0;
+    }
+
     BeatKeeper keeper(it->second, &choreo);
+    keeper.setTrackPollInterval(track_poll);
+
+    // 6) pipeline: the sampler thread reads Rekordbox and publishes samples,
+    //    this thread follows the beat and dispatches the choreography on
+    //    deadlines, the control thread reads keys (see pipeline.h)
+    using namespace std::chrono_literals;
+    using clk = Dispatcher::Clock;
+    using Source = Dispatcher::Source;
+    const auto console_period = std::chrono::duration_cast<clk::duration>(50ms);
+
+    console::RawMode raw_console;
 
-    using clk = std::chrono::high_resolution_clock;
-    auto last = clk::now();
-
-    std::cout << "Entering loop\n";
-    while (true) {
-        auto now = clk::now();
-        auto delta = std::chrono::duration_cast<std::chrono::microseconds>(now - last);
-        last = now;
-
-        keeper.update(delta);
-
-        /*
-        // send OSC beat‐fraction
-        if (osc_enabled) {
-            char buf[256];
-            osc::OutboundPacketStream p{ buf, sizeof(buf) };
-            p << osc::BeginMessage("/beat") << keeper.getBeatFraction() << osc::EndMessage;
-            oscSocket->Send(p.Data(), p.Size());
-            std::cout << "Beat fraction: " << keeper.getBeatFraction() << std::endl;
-        }
-
-        // BPM change
-        if (auto bpm = keeper.getBpmChanged()) {
-            if (osc_enabled) {
-                char buf[256];
-                osc::OutboundPacketStream p{ buf, sizeof(buf) };
-                p << osc::BeginMessage("/bpm") << *bpm << osc::EndMessage;
-                oscSocket->Send(p.Data(), p.Size());
+    SeqLock<RekordboxSample> samples;
+    pipeline::OutlookChannel outlook_channel;
+    pipeline::ControlChannel control;
+    pipeline::StageStats stages;
+    pipeline::TickHistograms ticks;
+    Dispatcher dispatcher(spin);
+    dispatcher.setWakeSource(Source::Sample);
+
+    std::optional<realtime::SelfTest> selftest;
+    if (selftest_seconds > 0) {
+        selftest.emplace(std::chrono::seconds(3), std::chrono::seconds(selftest_seconds));
+        LOG_INFO("Self-test: measuring the hot threads for %d s after a 3 s warm-up", selftest_seconds);
+    }
+    if (rt.enabled) realtime::lockMemory();
+
+    trace::TraceWriter recorder;
+    if (!record_trace.empty()) {
+        if (!recorder.open(record_trace)) {
+            LOG_ERROR("Cannot open trace file %s", record_trace.c_str());
+            return 1;
+        }
+        LOG_INFO("Recording samples to %s", record_trace.c_str());
+    }
+
+    Dispatcher sample_dispatcher(spin);
+    AdaptiveSampler sampler;
+    sampler.setRates(sample_min_hz, sample_max_hz);
+    std::thread sampler_thread([&] {
+        if (rt.enabled) realtime::makeThreadRealtime("sampler", rt.priority - 1, rt.samplerCpu);
+        RekordboxSample sample;
+        sample_dispatcher.schedule(Source::Sample, clk::now());
+        sample_dispatcher.run([&](Source, clk::time_point) {
+            if (control.quitting()) return false;
+            auto start = clk::now();
+            keeper.sample(sample);
+            samples.store(sample);
+            dispatcher.wake();
+            recorder.append(sample);
+            auto now = clk::now();
+            stages.sampleRead.add(pipeline::elapsedUs(start, now));
+
+            // fast around the next beat edge and slot, slow otherwise
+            AdaptiveSampler::Outlook outlook;
+            outlook_channel.read(outlook);
+            outlook.lastBeatChange = keeper.lastBeatChangeTime();
+            sample_dispatcher.schedule(Source::Sample, sampler.next(now, outlook));
+            if (selftest) selftest->tick(0);
+            return true;
+        });
+    });
+
+    Dispatcher control_dispatcher;
+    std::thread control_thread([&] {
+        control_dispatcher.schedule(Source::Console, clk::now());
+        control_dispatcher.run([&](Source, clk::time_point deadline) {
+            if (control.quitting()) return false;
+            if (console::keyPressed()) {
+                char c = console::getKey();
+                if (c == 'c') {
+                    control.quit();
+                    dispatcher.wake();
+                    return false;
+                }
+                if (c == 'i' || c == 'k') {
+                    control.nudge(c == 'i' ? +1 : -1);
+                    dispatcher.wake();
+                }
+                if (c == 'h') ticks.log(choreo.lateness());
             }
-            std::cout << "BPM changed to: " << *bpm << std::endl;
-        }*/
+            control_dispatcher.schedule(Source::Console, deadline + console_period);
+            return true;
+        });
+    });
 
-        
-                 // << ", Deck: " << (int)keeper.lastDeck() 
-                 // << ", Beats: " << keeper.lastBeat() 
-                 // << "\n";
+    if (rt.enabled) realtime::makeThreadRealtime("dispatcher", rt.priority, rt.dispatcherCpu);
+    LOG_INFO("Entering loop");
+    RekordboxSample latest;
+    uint64_t seen = 0;
+    clk::time_point last_start;
+    dispatcher.run([&](Source source, clk::time_point) {
+        if (control.quitting()) return false;
+        auto start = clk::now();
+        if (last_start != clk::time_point()) ticks.period.record(start - last_start);
+        last_start = start;
+
+        // edited choreographies, re-parsed by the watcher thread
+        choreo.applyReloads();
+        clk::time_point posted;
+        if (int ms = control.takeOffset(posted)) {
+            keeper.changeOffsetMs(static_cast<float>(ms));
+            stages.commandDelay.add(pipeline::elapsedUs(posted, start));
+        }
+
+        uint64_t version = samples.load(latest);
+        if (!version) return true;
+        if (source == Source::Sample && version != seen)
+            stages.snapshotAge.add(pipeline::elapsedUs(latest.sampled, start));
+        seen = version;
+        keeper.apply(latest);
 
         // new beat → Ableton Link
         //if (keeper.getNewBeat()) {
@@ -185,18 +438,43 @@ Usage:
         //    link.commitAppSessionState(state);
         //}
 
-        // console update
-        if (_kbhit()) {
-            char c = _getch();
-            if (c == 'c') break;
-            if (c == 'i') keeper.changeOffsetMs(+1.0f);
-            if (c == 'k') keeper.changeOffsetMs(-1.0f);
+        // re-arm the next choreography slot from the latest beat position
+        clk::time_point next_slot;
+        bool have_slot = choreo.nextDeadline(next_slot);
+        if (have_slot) {
+            // never schedule into the past: a slot the update didn't fire yet
+            // gets retried shortly instead of spinning the loop
+            auto earliest = clk::now() + dispatch_tolerance;
+            dispatcher.schedule(Source::Choreo, next_slot > earliest ? next_slot : earliest);
+        } else {
+            dispatcher.cancel(Source::Choreo);
+        }
+        outlook_channel.publish(choreo.active(), true, keeper.nextBeatTime(), have_slot, next_slot);
+        auto done = clk::now();
+        stages.dispatchWork.add(pipeline::elapsedUs(start, done));
+        ticks.duration.record(done - start);
+        if (selftest) {
+            selftest->tick(1);
+            if (selftest->finished()) return false;
         }
+        return true;
+    });
+    control.quit();
+    sampler_thread.join();
+    control_thread.join();
 
-        using namespace std::chrono_literals;
-        std::this_thread::sleep_for(1000000us / 120);
-    }
+    sample_dispatcher.logStats();
+    dispatcher.logStats();
+    control_dispatcher.logStats();
+    stages.log();
+    ticks.log(choreo.lateness());
+    sampler.logStats();
+    keeper.logStats();
+    choreo.logStats();
+    recorder.close();
+    bool passed = !selftest || selftest->report();
 
     //if (oscSocket) delete oscSocket;
-    return 0;
+    logger.stop();
+    return passed ? 0 : 2;
 }
@@ -0,0 +1,63 @@
+// seqlock.h
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// ------------------------
+// Single-writer seqlock
+// ------------------------
+// Hands the latest value of a trivially copyable T from one writer thread to
+// any number of readers without locks or allocation. The writer never waits;
+// a reader that raced a write retries its copy. Readers only ever see the
+// newest value, which is what a sampler feeding a dispatcher wants: a
+// snapshot the dispatcher was too slow to pick up is simply superseded.
+//
+// The payload is kept in relaxed atomic words so a racing copy is a retry,
+// not a data race.
+
+template<typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable_v<T>, "SeqLock payload must be trivially copyable");
+
+public:
+    /// Publish `value` (writer thread only)
+    void store(const T& value) {
+        std::array<uint64_t, kWords> words{};
+        std::memcpy(words.data(), &value, sizeof(T));
+        uint64_t seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);  // odd: write in progress
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < kWords; ++i) data_[i].store(words[i], std::memory_order_relaxed);
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    /// Copy the latest value into `value`. Returns its version, which grows
+    /// with every store; 0 means nothing was published yet.
+    uint64_t load(T& value) const {
+        std::array<uint64_t, kWords> words;
+        uint64_t before, after;
+        do {
+            before = seq_.load(std::memory_order_acquire);
+            if (before & 1) continue;
+            for (size_t i = 0; i < kWords; ++i) words[i] = data_[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = seq_.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+        if (before) std::memcpy(static_cast<void*>(&value), words.data(), sizeof(T));
+        return before / 2;
+    }
+
+    /// Version of the latest value, without copying it
+    uint64_t version() const { return seq_.load(std::memory_order_acquire) / 2; }
+
+private:
+    static constexpr size_t kWords = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    std::atomic<uint64_t> seq_{ 0 };
+    std::array<std::atomic<uint64_t>, kWords> data_{};
+};
@@ -0,0 +1,133 @@
+// thread_pool.h
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ------------------------
+// Work-stealing thread pool
+// ------------------------
+// Each worker owns a deque of work items: it takes from the back of its own
+// and, once that is empty, steals from the front of the others, so a few
+// slow items (a huge file) don't leave the rest of the pool idle.
+// parallelFor() deals the indices out round-robin and blocks until all of
+// them ran. The function must not throw; report errors through its captures.
+
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency()) {
+        threads = std::max<size_t>(threads, 1);
+        for (size_t i = 0; i < threads; ++i) queues_.push_back(std::make_unique<Queue>());
+        for (size_t i = 0; i < threads; ++i) workers_.emplace_back([this, i] { work(i); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto& t : workers_) t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /// Run fn(i) for every i in [0, count) on the workers
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn) {
+        if (count == 0) return;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < count; ++i) {
+            Queue& q = *queues_[i % queues_.size()];
+            std::lock_guard<std::mutex> ql(q.mutex);
+            q.items.push_back(i);
+        }
+        job_ = &fn;
+        remaining_ = count;
+        ++generation_;
+        wake_.notify_all();
+        done_.wait(lock, [this] { return remaining_ == 0 && active_ == 0; });
+        job_ = nullptr;
+    }
+
+    size_t size() const { return workers_.size(); }
+
+    /// Items run by a worker other than the one they were dealt to
+    uint64_t steals() const { return steals_.load(std::memory_order_relaxed); }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> items;
+    };
+
+    void work(size_t id) {
+        uint64_t seen = 0;
+        for (;;) {
+            const std::function<void(size_t)>* job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+                if (stop_) return;
+                seen = generation_;
+                job = job_;
+                if (!job) continue;  // woke after that batch already finished
+                ++active_;
+            }
+
+            size_t item, ran = 0;
+            while (take(id, item)) {
+                (*job)(item);
+                ++ran;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            remaining_ -= ran;
+            --active_;
+            if (remaining_ == 0 && active_ == 0) done_.notify_all();
+        }
+    }
+
+    bool take(size_t id, size_t& item) {
+        {
+            Queue& own = *queues_[id];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.items.empty()) {
+                item = own.items.back();
+                own.items.pop_back();
+                return true;
+            }
+        }
+        for (size_t k = 1; k < queues_.size(); ++k) {
+            Queue& victim = *queues_[(id + k) % queues_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.items.empty()) {
+                item = victim.items.front();
+                victim.items.pop_front();
+                steals_.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_, done_;
+    const std::function<void(size_t)>* job_ = nullptr;
+    uint64_t generation_ = 0;
+    size_t remaining_ = 0;
+    size_t active_ = 0;
+    bool stop_ = false;
+    std::atomic<uint64_t> steals_{ 0 };
+};
@@ -0,0 +1,334 @@
+// trace.h
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "beatkeeper.h"
+#include "choreographer.h"
+#include "logger.h"
+#include "mapped_file.h"
+
+namespace trace {
+
+// ------------------------
+// Rekordbox state traces
+// ------------------------
+// Every sample the sampler takes (BPM, both decks' beat counters, master
+// deck, track identity) appended to a binary file, so a set from a show can
+// be replayed into BeatKeeper and the Choreographer exactly, on any box and
+// without Rekordbox.
+//
+// Layout: Header, then records, each starting with a one-byte tag:
+//   'S' sample  int64 ns since the first sample, float BPM,
+//               int32 beats[2], uint8 master deck             (22 bytes)
+//   'T' track   uint8 deck, uint8 artist length + bytes,
+//               uint8 title length + bytes
+// A deck's 'T' record precedes the first sample that shows that track.
+// Fields are in host byte order. The file is append-only, so a recording
+// cut short by a crash replays up to its last whole record.
+
+struct Header {
+    char     magic[4];
+    uint32_t version;
+};
+
+static constexpr char     kMagic[4] = { 'R', 'K', 'T', 'R' };
+static constexpr uint32_t kVersion  = 1;
+static constexpr char     kSample   = 'S';
+static constexpr char     kTrack    = 'T';
+static constexpr size_t   kSampleBytes = 1 + 8 + 4 + 2 * 4 + 1;
+
+// ------------------------
+// Recording
+// ------------------------
+// Written from the sampler thread. The stdio buffer is allocated up front,
+// so appending a sample never allocates; it only reaches the kernel once
+// the buffer is full.
+
+class TraceWriter {
+public:
+    TraceWriter() = default;
+    ~TraceWriter() { close(); }
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    /// Start a new trace at `path`, replacing any file there
+    bool open(const std::string& path) {
+        close();
+        file_ = std::fopen(path.c_str(), "wb");
+        if (!file_) return false;
+        buffer_.resize(64 * 1024);
+        std::setvbuf(file_, buffer_.data(), _IOFBF, buffer_.size());
+        Header h{};
+        std::memcpy(h.magic, kMagic, sizeof(kMagic));
+        h.version = kVersion;
+        write(&h, sizeof(h));
+        path_ = path;
+        started_ = false;
+        return true;
+    }
+
+    explicit operator bool() const { return file_ != nullptr; }
+
+    /// Append one sample, preceded by the track of any deck that changed
+    void append(const RekordboxSample& s) {
+        if (!file_) return;
+        if (!started_) {
+            origin_ = s.sampled;
+            started_ = true;
+        }
+        for (int deck = 0; deck < 2; ++deck) {
+            if (samples_ && s.tracks[deck] == written_[deck]) continue;
+            written_[deck] = s.tracks[deck];
+            writeTrack(deck, s.tracks[deck]);
+        }
+        char record[kSampleBytes];
+        char* p = record;
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(s.sampled - origin_).count();
+        *p++ = kSample;
+        std::memcpy(p, &ns, 8);             p += 8;
+        std::memcpy(p, &s.master_bpm, 4);   p += 4;
+        std::memcpy(p, s.beats, 8);         p += 8;
+        *p++ = static_cast<char>(s.masterdeck_index);
+        write(record, sizeof(record));
+        ++samples_;
+    }
+
+    void close() {
+        if (!file_) return;
+        std::fclose(file_);
+        file_ = nullptr;
+        LOG_INFO("Trace: wrote %llu samples (%.1f KiB) to %s",
+                 static_cast<unsigned long long>(samples_), bytes_ / 1024.0, path_.c_str());
+    }
+
+private:
+    void write(const void* data, size_t size) {
+        if (std::fwrite(data, 1, size, file_) == size) {
+            bytes_ += size;
+        } else if (!failed_) {
+            failed_ = true;
+            LOG_ERROR("Trace: write to %s failed, the recording is incomplete", path_.c_str());
+        }
+    }
+
+    void writeTrack(int deck, const TrackId& track) {
+        char record[3 + 2 * TrackId::kCapacity + 1];
+        char* p = record;
+        *p++ = kTrack;
+        *p++ = static_cast<char>(deck);
+        size_t artist = track.artistLength(), title = track.titleLength();
+        *p++ = static_cast<char>(artist);
+        std::memcpy(p, track.artist.data(), artist);  p += artist;
+        *p++ = static_cast<char>(title);
+        std::memcpy(p, track.title.data(), title);    p += title;
+        write(record, static_cast<size_t>(p - record));
+    }
+
+    std::FILE* file_ = nullptr;
+    std::vector<char> buffer_;
+    std::string path_;
+    std::chrono::steady_clock::time_point origin_;
+    bool started_ = false;
+    bool failed_ = false;
+    std::array<TrackId, 2> written_{};
+    uint64_t samples_ = 0;
+    uint64_t bytes_ = 0;
+};
+
+// ------------------------
+// Reading
+// ------------------------
+// Turns the records back into RekordboxSamples on a clock that starts at
+// `origin`, filling in what the sampler derives itself (when each deck's
+// counter last showed its previous beat).
+
+class TraceReader {
+public:
+    bool open(const std::string& path) {
+        if (!file_.open(path)) {
+            LOG_ERROR("Trace: cannot open %s", path.c_str());
+            return false;
+        }
+        Header h{};
+        if (file_.size() < sizeof(h)) {
+            LOG_ERROR("Trace: %s is not a trace", path.c_str());
+            return false;
+        }
+        std::memcpy(&h, file_.data(), sizeof(h));
+        if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 || h.version != kVersion) {
+            LOG_ERROR("Trace: %s is not a version %u trace", path.c_str(), kVersion);
+            return false;
+        }
+        path_ = path;
+        start(std::chrono::steady_clock::now());
+        return true;
+    }
+
+    /// Replay from the first record, with the first sample taken at `origin`
+    void start(std::chrono::steady_clock::time_point origin) {
+        origin_ = origin;
+        pos_ = sizeof(Header);
+        current_ = RekordboxSample{};
+        lastSampled_ = origin;
+    }
+
+    /// Next sample; false at the end of the trace
+    bool next(RekordboxSample& s) {
+        const char* data = file_.data();
+        size_t size = file_.size();
+        while (pos_ < size) {
+            const char* p = data + pos_;
+            size_t left = size - pos_;
+            if (*p == kSample) {
+                if (left < kSampleBytes) return truncated();
+                int64_t ns;
+                std::memcpy(&ns, p + 1, 8);
+                std::memcpy(&current_.master_bpm, p + 9, 4);
+                int32_t beats[2];
+                std::memcpy(beats, p + 13, 8);
+                current_.masterdeck_index = static_cast<uint8_t>(p[21]);
+                pos_ += kSampleBytes;
+
+                current_.sampled = origin_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::nanoseconds(ns));
+                for (int deck = 0; deck < 2; ++deck) {
+                    if (beats[deck] != current_.beats[deck]) current_.before_edge[deck] = lastSampled_;
+                    current_.beats[deck] = beats[deck];
+                }
+                lastSampled_ = current_.sampled;
+                s = current_;
+                return true;
+            }
+            if (*p == kTrack) {
+                if (left < 3) return truncated();
+                int deck = p[1];
+                size_t artist = static_cast<uint8_t>(p[2]);
+                if (left < 4 + artist) return truncated();
+                size_t title = static_cast<uint8_t>(p[3 + artist]);
+                if (left < 4 + artist + title) return truncated();
+                if (deck < 0 || deck > 1 || artist > TrackId::kCapacity || title > TrackId::kCapacity) {
+                    LOG_ERROR("Trace: %s has a bad track record at byte %zu", path_.c_str(), pos_);
+                    pos_ = size;
+                    return false;
+                }
+                std::array<char, TrackId::kCapacity> a{}, t{};
+                std::memcpy(a.data(), p + 3, artist);
+                std::memcpy(t.data(), p + 4 + artist, title);
+                current_.tracks[deck].assign(a, t);
+                pos_ += 4 + artist + title;
+                continue;
+            }
+            LOG_ERROR("Trace: %s has an unknown record at byte %zu", path_.c_str(), pos_);
+            pos_ = size;
+            return false;
+        }
+        return false;
+    }
+
+private:
+    bool truncated() {
+        LOG_WARN("Trace: %s ends in a partial record, replaying up to it", path_.c_str());
+        pos_ = file_.size();
+        return false;
+    }
+
+    MappedFile file_;
+    std::string path_;
+    size_t pos_ = 0;
+    std::chrono::steady_clock::time_point origin_, lastSampled_;
+    RekordboxSample current_;
+};
+
+// ------------------------
+// Replay
+// ------------------------
+// Feeds a trace through BeatKeeper::apply() the way the dispatcher would: on
+// every sample, and in between at each choreography slot the Choreographer
+// asks for. In real time it sleeps until each of those moments; in virtual
+// time it jumps straight to them, which replays a set as fast as the beat
+// tracking and choreography can go.
+
+class Replay {
+public:
+    Replay(TraceReader& reader, BeatKeeper& keeper, Choreographer& choreo)
+        : reader_(reader), keeper_(keeper), choreo_(choreo) {}
+
+    /// Slot ticks are never scheduled closer than this to the previous one
+    void setTolerance(std::chrono::microseconds tolerance) { tolerance_ = tolerance; }
+
+    void run(bool virtualTime) {
+        using Clock = std::chrono::steady_clock;
+        virtual_ = virtualTime;
+        auto wallStart = Clock::now();
+        Clock::time_point origin = wallStart;
+        Clock::time_point vnow = origin;
+        auto now = [&] { return virtual_ ? vnow : Clock::now(); };
+        auto waitUntil = [&](Clock::time_point t) {
+            if (virtual_) vnow = std::max(vnow, t);
+            else std::this_thread::sleep_until(t);
+        };
+        auto tick = [&](const RekordboxSample& s) {
+            choreo_.applyReloads();
+            keeper_.apply(s, now());
+            if (virtual_) choreo_.finishLoads();
+        };
+
+        reader_.start(origin);
+        RekordboxSample sample, previous;
+        bool have = false;
+        while (reader_.next(sample)) {
+            if (have) {
+                // choreography slots due before this sample, on the previous one
+                Clock::time_point slot;
+                while (choreo_.nextDeadline(slot)) {
+                    auto earliest = now() + tolerance_;
+                    if (slot < earliest) slot = earliest;
+                    if (slot >= sample.sampled) break;
+                    waitUntil(slot);
+                    tick(previous);
+                    ++slotTicks_;
+                }
+            }
+            waitUntil(sample.sampled);
+            tick(sample);
+            ++samples_;
+            previous = sample;
+            have = true;
+        }
+        span_ = have ? previous.sampled - origin : Clock::duration::zero();
+        wall_ = Clock::now() - wallStart;
+    }
+
+    void logStats() const {
+        double span = std::chrono::duration<double>(span_).count();
+        double wall = std::chrono::duration<double>(wall_).count();
+        uint64_t ticks = samples_ + slotTicks_;
+        LOG_INFO("Replay (%s time): %llu samples and %llu slot ticks over %.1f s of trace in %.3f s "
+                 "(%.1fx real time, %.2f us per tick)",
+                 virtual_ ? "virtual" : "real", static_cast<unsigned long long>(samples_),
+                 static_cast<unsigned long long>(slotTicks_), span, wall,
+                 wall > 0.0 ? span / wall : 0.0, ticks ? wall * 1e6 / static_cast<double>(ticks) : 0.0);
+    }
+
+private:
+    TraceReader& reader_;
+    BeatKeeper& keeper_;
+    Choreographer& choreo_;
+    std::chrono::microseconds tolerance_{ 500 };
+    bool virtual_ = false;
+    uint64_t samples_ = 0;
+    uint64_t slotTicks_ = 0;
+    std::chrono::steady_clock::duration span_{}, wall_{};
+};
+
+} // namespace trace
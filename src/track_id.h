@@ -0,0 +1,51 @@
+// track_id.h
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "hash.h"
+
+// ------------------------
+// Track identity
+// ------------------------
+// Artist/title as read from Rekordbox, kept in fixed-capacity inline
+// buffers with a hash so "did the track change?" is a hash compare (plus a
+// memcmp on a hash match) and never allocates. std::strings are only made
+// when the identity actually changes.
+
+struct TrackId {
+    static constexpr size_t kCapacity = 100;
+
+    std::array<char, kCapacity> artist{};
+    std::array<char, kCapacity> title{};
+    uint64_t hash = 0;
+
+    /// Take raw (possibly unterminated) buffers; bytes after the terminator are cleared
+    void assign(const std::array<char, kCapacity>& a, const std::array<char, kCapacity>& t) {
+        copyTerminated(artist, a);
+        copyTerminated(title, t);
+        hash = fnv1a(title.data(), title.size(), fnv1a(artist.data(), artist.size()));
+    }
+
+    size_t artistLength() const { return strnlen(artist.data(), kCapacity); }
+    size_t titleLength() const { return strnlen(title.data(), kCapacity); }
+
+    std::string artistString() const { return std::string(artist.data(), artistLength()); }
+    std::string titleString() const { return std::string(title.data(), titleLength()); }
+
+    bool operator==(const TrackId& o) const {
+        return hash == o.hash && artist == o.artist && title == o.title;
+    }
+    bool operator!=(const TrackId& o) const { return !(*this == o); }
+
+private:
+    static void copyTerminated(std::array<char, kCapacity>& dst, const std::array<char, kCapacity>& src) {
+        size_t n = strnlen(src.data(), kCapacity);
+        std::memcpy(dst.data(), src.data(), n);
+        std::memset(dst.data() + n, 0, kCapacity - n);
+    }
+};
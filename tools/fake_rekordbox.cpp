@@ -0,0 +1,211 @@
+// fake_rekordbox.cpp
+//
+// Stand-in "rekordbox.exe" for Linux: maps a sparse file called rekordbox.exe
+// as the main module, lays out every pointer chain from offsets.txt behind it
+// and plays a fake set, so the real Rekordbox::refresh path can be run and
+// profiled through LinuxMemorySource without Rekordbox.
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+#include "src/offsets.h"
+
+namespace {
+
+std::atomic<bool> running{ true };
+
+void onSignal(int) { running = false; }
+
+// every intermediate object the chains point into
+constexpr size_t kBlockSize = 0x4000;
+
+class FakeProcess {
+public:
+    FakeProcess(const RekordboxOffsets& off, const std::filesystem::path& dir) {
+        // main module: a sparse file so /proc/<pid>/maps names it rekordbox.exe
+        uintptr_t moduleSize = 0;
+        for (const Pointer* p : all(off))
+            moduleSize = std::max(moduleSize, (p->depth == 0 ? p->final_offset : p->offsets[0]) + 0x1000);
+        modulePath_ = dir / "rekordbox.exe";
+        int fd = ::open(modulePath_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0 || ftruncate(fd, static_cast<off_t>(moduleSize)) != 0)
+            throw std::runtime_error("Cannot create " + modulePath_.string());
+        void* m = mmap(nullptr, moduleSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED) throw std::runtime_error("Cannot map fake module");
+        base_ = reinterpret_cast<uintptr_t>(m);
+        moduleSize_ = moduleSize;
+
+        deck1bar_   = layout(off.deck1bar);
+        deck1beat_  = layout(off.deck1beat);
+        deck2bar_   = layout(off.deck2bar);
+        deck2beat_  = layout(off.deck2beat);
+        bpm_        = layout(off.master_bpm);
+        master_     = layout(off.masterdeck_index);
+        d1artist_   = layout(off.deck1artist);
+        d1title_    = layout(off.deck1title);
+        d2artist_   = layout(off.deck2artist);
+        d2title_    = layout(off.deck2title);
+    }
+
+    ~FakeProcess() {
+        munmap(reinterpret_cast<void*>(base_), moduleSize_);
+        for (void* b : blocks_) std::free(b);
+        std::error_code ec;
+        std::filesystem::remove(modulePath_, ec);
+    }
+
+    uintptr_t base() const { return base_; }
+    size_t blocks() const { return blocks_.size(); }
+
+    void setDeck(int deck, int32_t beatNumber) {
+        int32_t bar  = (beatNumber - 1) / 4 + 1;
+        int32_t beat = (beatNumber - 1) % 4 + 1;
+        write<int32_t>(deck == 0 ? deck1bar_ : deck2bar_, bar);
+        write<int32_t>(deck == 0 ? deck1beat_ : deck2beat_, beat);
+    }
+    void setBpm(float bpm) { write<float>(bpm_, bpm); }
+    void setMaster(uint8_t deck) { write<uint8_t>(master_, deck); }
+    void setTrack(int deck, const std::string& artist, const std::string& title) {
+        writeString(deck == 0 ? d1artist_ : d2artist_, artist);
+        writeString(deck == 0 ? d1title_ : d2title_, title);
+    }
+
+private:
+    static std::vector<const Pointer*> all(const RekordboxOffsets& o) {
+        return { &o.deck1bar, &o.deck1beat, &o.deck2bar, &o.deck2beat, &o.master_bpm,
+                 &o.masterdeck_index, &o.deck1artist, &o.deck1title, &o.deck2artist, &o.deck2title };
+    }
+
+    /// Make the chain resolvable and return the final field address.
+    /// Chains sharing a prefix share the intermediate objects.
+    uintptr_t layout(const Pointer& p) {
+        uintptr_t addr = base_;
+        for (auto off : p.hops()) {
+            auto key = std::make_pair(addr, off);
+            auto it = links_.find(key);
+            if (it == links_.end()) {
+                void* block = std::calloc(1, kBlockSize);
+                blocks_.push_back(block);
+                uintptr_t target = reinterpret_cast<uintptr_t>(block);
+                std::memcpy(reinterpret_cast<void*>(addr + off), &target, sizeof(target));
+                it = links_.emplace(key, target).first;
+            }
+            addr = it->second;
+        }
+        if (p.final_offset + 100 > kBlockSize)
+            throw std::runtime_error("Final offset too large for fake block");
+        return addr + p.final_offset;
+    }
+
+    template<typename T>
+    static void write(uintptr_t addr, T v) { std::memcpy(reinterpret_cast<void*>(addr), &v, sizeof(v)); }
+
+    static void writeString(uintptr_t addr, const std::string& s) {
+        char buf[100] = {};
+        std::memcpy(buf, s.data(), std::min(s.size(), sizeof(buf) - 1));
+        std::memcpy(reinterpret_cast<void*>(addr), buf, sizeof(buf));
+    }
+
+    std::filesystem::path modulePath_;
+    uintptr_t base_ = 0;
+    size_t moduleSize_ = 0;
+    std::map<std::pair<uintptr_t, uintptr_t>, uintptr_t> links_;
+    std::vector<void*> blocks_;
+    uintptr_t deck1bar_, deck1beat_, deck2bar_, deck2beat_, bpm_, master_,
+              d1artist_, d1title_, d2artist_, d2title_;
+};
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string offsets_path = "offsets.txt";
+    std::string version;
+    float bpm = 128.0f;
+    int switch_seconds = 0;
+    std::string artist1 = "Viperactive", title1 = "Snakebite";
+    std::string artist2 = "Fake Artist", title2 = "Fake Title";
+
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "-p" && i + 1 < argc) offsets_path = argv[++i];
+        else if (a == "-v" && i + 1 < argc) version = argv[++i];
+        else if (a == "-b" && i + 1 < argc) bpm = std::stof(argv[++i]);
+        else if (a == "-x" && i + 1 < argc) switch_seconds = std::stoi(argv[++i]);
+        else if (a == "-1" && i + 2 < argc) { artist1 = argv[++i]; title1 = argv[++i]; }
+        else if (a == "-2" && i + 2 < argc) { artist2 = argv[++i]; title2 = argv[++i]; }
+        else {
+            std::cout << "Usage:\n"
+                "  -p <file>          offsets file (default: offsets.txt)\n"
+                "  -v <ver>           RB version to lay out (default: latest)\n"
+                "  -b <bpm>           tempo of both decks (default: 128)\n"
+                "  -x <sec>           swap the master deck every <sec> seconds\n"
+                "  -1 <artist> <title> deck 1 track\n"
+                "  -2 <artist> <title> deck 2 track\n";
+            return a == "-h" ? 0 : 1;
+        }
+    }
+
+    auto versions = RekordboxOffsets::loadFromFile(offsets_path);
+    if (versions.empty()) { std::cerr << "No offsets parsed!\n"; return 1; }
+    auto it = version.empty() ? std::prev(versions.end()) : versions.find(version);
+    if (it == versions.end()) { std::cerr << "Unsupported version: " << version << "\n"; return 1; }
+
+    // look like rekordbox and let unrelated (non-parent) processes read us
+    prctl(PR_SET_NAME, "rekordbox.exe", 0, 0, 0);
+#ifdef PR_SET_PTRACER
+    prctl(PR_SET_PTRACER, PR_SET_PTRACER_ANY, 0, 0, 0);
+#endif
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    auto dir = std::filesystem::temp_directory_path() / ("fake_rekordbox_" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir);
+    {
+        FakeProcess fake(it->second, dir);
+        fake.setBpm(bpm);
+        fake.setMaster(0);
+        fake.setTrack(0, artist1, title1);
+        fake.setTrack(1, artist2, title2);
+        std::cout << "Fake rekordbox " << it->first << " pid " << getpid()
+                  << ", module at 0x" << std::hex << fake.base() << std::dec
+                  << ", " << fake.blocks() << " chain objects" << std::endl;
+
+        // both decks play from the top, deck 2 one bar behind
+        using clk = std::chrono::steady_clock;
+        auto start = clk::now();
+        uint8_t master = 0;
+        auto last_switch = start;
+        while (running) {
+            auto now = clk::now();
+            double beats = std::chrono::duration<double>(now - start).count() * bpm / 60.0;
+            fake.setDeck(0, static_cast<int32_t>(beats) + 1);
+            fake.setDeck(1, std::max(1, static_cast<int32_t>(beats) - 3));
+            if (switch_seconds > 0 && now - last_switch >= std::chrono::seconds(switch_seconds)) {
+                master ^= 1;
+                fake.setMaster(master);
+                last_switch = now;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
@@ -0,0 +1,310 @@
+// rkbx_bench.cpp
+//
+// Micro-benchmarks of the choreography hot paths: TSV parsing, cursor ticks
+// at several slot densities, OSC serialization, track matching and the beat
+// conversions. Each reports ns/op, heap allocations/op and allocated
+// bytes/op (plus the bytes each op processes, where that means something),
+// as a table or as JSON for diffing two builds.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/alloc_counter.h"
+#include "src/beat_utils.h"
+#include "src/choreo_cursor.h"
+#include "src/choreoparser.h"
+#include "src/logger.h"
+#include "src/oscpacket.h"
+
+RKBX_DEFINE_ALLOCATION_COUNTER
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/// Keep `value` alive without letting the compiler see what it's used for
+template<typename T>
+inline void keep(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+struct Result {
+    std::string name;
+    uint64_t iterations = 0;
+    double   nsPerOp = 0.0;
+    double   allocsPerOp = 0.0;
+    double   allocBytesPerOp = 0.0;
+    double   bytesPerOp = 0.0;  // input or output size of one op, 0 if not meaningful
+};
+
+class Bench {
+public:
+    Bench(double minSeconds, std::string filter)
+        : minTime_(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(minSeconds)))
+        , filter_(std::move(filter)) {}
+
+    /// Time `op` (which does one op per call) in doubling batches until a
+    /// batch takes at least the minimum time
+    void run(const std::string& name, double bytesPerOp, const std::function<void()>& op) {
+        if (!filter_.empty() && name.find(filter_) == std::string::npos) return;
+        op();  // warm up caches and any lazily built state
+        for (uint64_t n = 1;; n *= 2) {
+            uint64_t allocs = alloc_counter::allocations.load(std::memory_order_relaxed);
+            uint64_t bytes = alloc_counter::bytes.load(std::memory_order_relaxed);
+            auto start = Clock::now();
+            for (uint64_t i = 0; i < n; ++i) op();
+            auto elapsed = Clock::now() - start;
+            if (elapsed < minTime_ && n < (uint64_t(1) << 40)) continue;
+            Result r;
+            r.name = name;
+            r.iterations = n;
+            r.nsPerOp = std::chrono::duration<double, std::nano>(elapsed).count() / double(n);
+            r.allocsPerOp = double(alloc_counter::allocations.load(std::memory_order_relaxed) - allocs) / double(n);
+            r.allocBytesPerOp = double(alloc_counter::bytes.load(std::memory_order_relaxed) - bytes) / double(n);
+            r.bytesPerOp = bytesPerOp;
+            results_.push_back(r);
+            return;
+        }
+    }
+
+    void printTable() const {
+        std::printf("%-34s %12s %12s %12s %12s %12s\n",
+                    "benchmark", "ns/op", "allocs/op", "alloc B/op", "bytes/op", "iterations");
+        for (const auto& r : results_)
+            std::printf("%-34s %12.1f %12.2f %12.1f %12.0f %12llu\n", r.name.c_str(), r.nsPerOp,
+                        r.allocsPerOp, r.allocBytesPerOp, r.bytesPerOp,
+                        static_cast<unsigned long long>(r.iterations));
+    }
+
+    void printJson() const {
+        std::printf("{\n  \"benchmarks\": [\n");
+        for (size_t i = 0; i < results_.size(); ++i) {
+            const auto& r = results_[i];
+            std::printf("    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.3f, "
+                        "\"allocs_per_op\": %.3f, \"alloc_bytes_per_op\": %.1f, \"bytes_per_op\": %.0f}%s\n",
+                        r.name.c_str(), static_cast<unsigned long long>(r.iterations), r.nsPerOp,
+                        r.allocsPerOp, r.allocBytesPerOp, r.bytesPerOp, i + 1 < results_.size() ? "," : "");
+        }
+        std::printf("  ]\n}\n");
+    }
+
+private:
+    Clock::duration minTime_;
+    std::string filter_;
+    std::vector<Result> results_;
+};
+
+/// Write a choreography of `bars` bars with `perBeat` slots per beat, each
+/// slot sending `messages` messages, the way a show file looks
+std::filesystem::path writeChoreo(const std::filesystem::path& dir, int bars, int perBeat, int messages) {
+    auto path = dir / ("bench_" + std::to_string(perBeat) + "_per_beat.tsv");
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << "#generated by rkbx_bench\n"
+        << "Match Song\tBench Song\tBench Song (Extended Mix)\n"
+        << "Match Artist\tBench Artist\n";
+    for (int bar = 1; bar <= bars; ++bar) {
+        if (bar % 16 == 1) out << "#section " << bar << '\n';
+        for (int beat = 1; beat <= 4; ++beat) {
+            for (int s = 0; s < perBeat; ++s) {
+                out << bar << '.' << beat << '\t' << double(s) / perBeat;
+                for (int m = 0; m < messages; ++m) {
+                    int layer = (bar + beat + s + m) % 8 + 1;
+                    switch (m % 3) {
+                        case 0: out << "\t/composition/layers/" << layer << "/clips/" << (s % 4 + 1) << "/connect\t1\ti"; break;
+                        case 1: out << "\t/composition/layers/" << layer << "/video/opacity\t0.75\tf"; break;
+                        case 2: out << "\t/composition/layers/" << layer << "/name\tdrop\ts"; break;
+                    }
+                }
+                out << '\n';
+            }
+        }
+    }
+    return path;
+}
+
+void benchParsing(Bench& bench, const std::filesystem::path& dir) {
+    for (int perBeat : { 1, 4, 16 }) {
+        auto path = writeChoreo(dir, 128, perBeat, 2);
+        double size = double(std::filesystem::file_size(path));
+        // loadAndOptimize() and buildRuntimeInstructions() only run from the
+        // constructor, so they are timed together
+        bench.run("parse_tsv/" + std::to_string(perBeat) + "_per_beat", size, [&] {
+            choreo::ChoreoParser parser(path.string());
+            keep(parser.timeline().size());
+        });
+    }
+
+    // the encoding that dominates buildRuntimeInstructions()
+    choreo::OSCMessage msgs[] = {
+        { "/composition/layers/3/clips/2/connect", 'i', "1" },
+        { "/composition/layers/3/video/opacity", 'f', "0.75" },
+        { "/composition/layers/3/name", 's', "drop" },
+    };
+    std::vector<char> encoded;
+    for (const auto& m : msgs) {
+        encoded.clear();
+        choreo::encodeMessage(m, encoded);
+        std::string name = std::string("encode_message/") + m.type;
+        bench.run(name, double(encoded.size()), [&] {
+            encoded.clear();
+            choreo::encodeMessage(m, encoded);
+            keep(encoded.data());
+        });
+    }
+}
+
+void benchCursor(Bench& bench, const std::filesystem::path& dir) {
+    // a 500 Hz tick at 128 BPM
+    constexpr double kBpm = 128.0;
+    constexpr double kStep = kBpm / 60.0 / 500.0;
+    for (int perBeat : { 1, 4, 16, 64 }) {
+        auto path = writeChoreo(dir, 64, perBeat, perBeat >= 16 ? 1 : 2);
+        auto parser = std::make_shared<const choreo::ChoreoParser>(path.string());
+        double end = parser->timeline().times.back() + 1.0;
+        choreo::ChoreoCursor cursor;
+        cursor.attach(parser);
+        choreo::PacketBuilder packet;
+        uint64_t ticks = 0;
+        double pos = 1.0;
+        bench.run("cursor_tick/" + std::to_string(perBeat) + "_per_beat", 0.0, [&] {
+            pos += kStep;
+            if (pos >= end) pos = 1.0;  // loops back: a seek
+            double beat = std::floor(pos);
+            cursor.update(static_cast<int>(beat), pos - beat, kStep, packet);
+            packet.flush();
+            ++ticks;
+        });
+        keep(ticks);
+    }
+}
+
+void benchSerialization(Bench& bench) {
+    char buffer[choreo::PacketBuilder::kCapacity];
+    size_t size = 0;
+    bench.run("osc_stream/message_i", 0.0, [&] {
+        osc::OutboundPacketStream p(buffer, sizeof(buffer));
+        p << osc::BeginMessage("/composition/layers/3/clips/2/connect") << osc::int32(1) << osc::EndMessage;
+        size = p.Size();
+        keep(buffer);
+    });
+    bench.run("osc_stream/bundle_ifs", 0.0, [&] {
+        osc::OutboundPacketStream p(buffer, sizeof(buffer));
+        p << osc::BeginBundleImmediate
+          << osc::BeginMessage("/composition/layers/3/clips/2/connect") << osc::int32(1) << osc::EndMessage
+          << osc::BeginMessage("/composition/layers/3/video/opacity") << 0.75f << osc::EndMessage
+          << osc::BeginMessage("/composition/layers/3/name") << "drop" << osc::EndMessage
+          << osc::EndBundle;
+        size = p.Size();
+        keep(buffer);
+    });
+    keep(size);
+
+    // what a tick actually does: memcpy pre-encoded slots into a datagram
+    std::vector<char> slot;
+    choreo::encodeMessage({ "/composition/layers/3/clips/2/connect", 'i', "1" }, slot);
+    choreo::encodeMessage({ "/composition/layers/3/video/opacity", 'f', "0.75" }, slot);
+    choreo::PacketBuilder packet;
+    bench.run("packet_builder/slot_of_2", double(slot.size()), [&] {
+        packet.append(slot.data(), slot.size(), 2);
+        packet.flush();
+    });
+}
+
+void benchMatching(Bench& bench, const std::filesystem::path& dir) {
+    auto path = writeChoreo(dir, 4, 1, 1);
+    choreo::ChoreoParser parser(path.string());
+    const std::string artist = "Bench Artist", title = "Bench Song (Extended Mix)";
+    const std::string other = "Somebody Else";
+    bench.run("normalize", double(title.size()), [&] {
+        auto n = choreo::ChoreoParser::normalize(title);
+        keep(n.data());
+    });
+    bench.run("matches/hit", 0.0, [&] {
+        bool m = parser.matches(artist, title);
+        keep(m);
+    });
+    bench.run("matches/miss", 0.0, [&] {
+        bool m = parser.matches(other, title);
+        keep(m);
+    });
+}
+
+void benchBeatUtils(Bench& bench) {
+    int32_t n = 1;
+    bench.run("beat_utils/bar_beat_to_number", 0.0, [&] {
+        n = barBeatToBeatNumber(n % 512 + 1, n % 4 + 1);
+        keep(n);
+    });
+    bench.run("beat_utils/number_to_bar_beat", 0.0, [&] {
+        auto bb = beatNumberToBarBeat(++n);
+        keep(bb);
+    });
+    double t = 0.0;
+    bench.run("beat_utils/time_to_number", 0.0, [&] {
+        t += 0.002;
+        double b = timeToBeatNumber(t, 128.0);
+        keep(b);
+    });
+    bench.run("beat_utils/number_to_time", 0.0, [&] {
+        t += 0.002;
+        double s = beatNumberToTime(t, 128.0);
+        keep(s);
+    });
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    bool json = false;
+    double minSeconds = 0.2;
+    std::string filter;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "-j") {
+            json = true;
+        } else if (a == "-f" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (a == "-t" && i + 1 < argc) {
+            minSeconds = std::atof(argv[++i]);
+        } else {
+            std::cout << "Usage: rkbx_bench [-j] [-f <substring>] [-t <sec>]\n"
+                         "  -j        JSON output, for diffing builds\n"
+                         "  -f <str>  only run benchmarks whose name contains <str>\n"
+                         "  -t <sec>  minimum measured time per benchmark (default: 0.2)\n";
+            return a == "-h" ? 0 : 1;
+        }
+    }
+
+    // slot printing is skipped below Info, as on a show machine
+    rklog::Logger::instance().setLevel(rklog::Level::Warn);
+
+    std::error_code ec;
+    auto dir = std::filesystem::temp_directory_path() / "rkbx_bench";
+    std::filesystem::create_directories(dir, ec);
+
+    Bench bench(minSeconds, filter);
+    benchParsing(bench, dir);
+    benchCursor(bench, dir);
+    benchSerialization(bench);
+    benchMatching(bench, dir);
+    benchBeatUtils(bench);
+
+    std::filesystem::remove_all(dir, ec);
+    if (json) bench.printJson();
+    else bench.printTable();
+    return 0;
+}